@@ -1,6 +1,8 @@
 #pragma once
 
+#include <fstream>
 #include <string>
+#include <type_traits>
 #include <utility>
 #include <ostream>
 
@@ -19,11 +21,34 @@ struct FileHeader
 	uint64_t offset;
 };
 
+// values of FileHeader::flags; version 1 files are n x m, version 2 ones are packed and version 3 ones are sparse
+namespace MatrixFlags
+{
+	// only the lower triangle of a square matrix is stored, row by row, so (i, j) with j <= i is at i * (i + 1) / 2 + j
+	constexpr uint16_t packed = 1;
+	// (j, i) of a packed matrix is the negation of (i, j), otherwise the two are equal
+	constexpr uint16_t antisymmetric = 2;
+	// the elements are PairRecords holding all outputs of a pair, see SpecialMatrices.h
+	constexpr uint16_t records = 4;
+	// only the pairs scoring below a cutoff are stored, as compressed rows: the FileHeader is followed by a
+	// SparseHeader, and offset points at n + 1 row starts followed by the SparseEntries of every row sorted by
+	// column, see SpecialMatrices.h; with packed, the rows hold only the lower triangle
+	constexpr uint16_t sparse = 8;
+}
+
+inline FileHeader read_file_header(std::string_view path)
+{
+	FileHeader header{};
+	std::ifstream(std::string(path), std::ios::binary).read(reinterpret_cast<char*>(&header), sizeof(header));
+	return header;
+}
+
 template <typename ValueType>
 class MemoryMappedMatrix
 {
 private:
 	size_t n, m, offset;
+	uint16_t flags;
 	MemoryMapped file;
 
 	FileHeader* getHeaderPointer()
@@ -34,6 +59,10 @@ private:
 	{
 		return reinterpret_cast<ValueType*> (file.getData() + offset);
 	}
+	size_t row_start(size_t index) const
+	{
+		return is_packed() ? index * (index + 1) / 2 : index * m;
+	}
 
 public:
 
@@ -45,19 +74,22 @@ public:
 		n = ptr->n;
 		m = ptr->m;
 		offset = ptr->offset;
+		flags = ptr->flags;
 	}
 
-	MemoryMappedMatrix(std::string_view path, size_t n, size_t m) :n(n), m(m), offset(sizeof(FileHeader))
+	MemoryMappedMatrix(std::string_view path, size_t n, size_t m, uint16_t flags = 0) :n(n), m(m), offset(sizeof(FileHeader)), flags(flags)
 	{
-		size_t fsize = offset + n * m * sizeof(ValueType);
+		assert(!is_packed() || n == m);
+		size_t elements = is_packed() ? n * (n + 1) / 2 : n * m;
+		size_t fsize = offset + elements * sizeof(ValueType);
 
 		file.open(path, fsize);
 
 		FileHeader *ptr = getHeaderPointer();
 
 		{
-			ptr->version = 1;
-			ptr->flags = 0;
+			ptr->version = is_packed() ? 2 : 1;
+			ptr->flags = flags;
 			ptr->element_size = sizeof(ValueType);
 			ptr->n = n;
 			ptr->m = m;
@@ -80,9 +112,49 @@ public:
 		return out << "MemoryMappedMatrix{ n=" << mat.n << ", m=" << mat.m << " }";
 	}
 
+	uint16_t get_flags() const
+	{
+		return flags;
+	}
+
+	bool is_packed() const
+	{
+		return flags & MatrixFlags::packed;
+	}
+
+	// in a packed matrix, only the elements up to and including the diagonal exist in a row
 	ValueType *operator[](size_t index)
 	{
-		return getDataPointer() + index * m;
+		return getDataPointer() + row_start(index);
+	}
+
+	// element (i, j) of either layout
+	ValueType get(size_t i, size_t j)
+	{
+		if (!is_packed() || j <= i) return (*this)[i][j];
+
+		ValueType value = (*this)[j][i];
+		if constexpr (requires { value.transposed(); })
+		{
+			return value.transposed();
+		}
+		else if constexpr (std::is_signed_v<ValueType>)
+		{
+			if (flags & MatrixFlags::antisymmetric) return -value;
+		}
+		return value;
+	}
+
+	// write the modified rows back to the file; with release, they also stop counting towards resident memory
+	void flush(bool release = false)
+	{
+		file.flush(0, file.mappedSize(), release);
+	}
+
+	// same, for the rows [first, last) only
+	void flush_rows(size_t first, size_t last, bool release = false)
+	{
+		file.flush(offset + row_start(first) * sizeof(ValueType), (row_start(last) - row_start(first)) * sizeof(ValueType), release);
 	}
 };
 
@@ -0,0 +1,190 @@
+#include "ParallelFor.h"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+std::unique_ptr<ThreadPool> ThreadPool::global_pool;
+
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+typedef cpu_set_t Affinity;
+
+static Affinity current_affinity()
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	pthread_getaffinity_np(pthread_self(), sizeof(set), &set);
+	return set;
+}
+
+static void set_affinity(const Affinity& set)
+{
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// the logical CPUs in the set, in increasing order
+static std::vector<unsigned> affinity_cpus(const Affinity& set)
+{
+	std::vector<unsigned> cpus;
+	for (unsigned cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	{
+		if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+	}
+	return cpus;
+}
+
+static Affinity single_cpu(unsigned cpu)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return set;
+}
+#elif defined(_WIN32)
+typedef DWORD_PTR Affinity;
+
+static Affinity current_affinity()
+{
+	DWORD_PTR process_mask, system_mask;
+	GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask);
+	return process_mask;
+}
+
+static void set_affinity(const Affinity& mask)
+{
+	SetThreadAffinityMask(GetCurrentThread(), mask);
+}
+
+static std::vector<unsigned> affinity_cpus(const Affinity& mask)
+{
+	std::vector<unsigned> cpus;
+	for (unsigned cpu = 0; cpu < 8 * sizeof(DWORD_PTR); cpu++)
+	{
+		if (mask & (DWORD_PTR(1) << cpu)) cpus.push_back(cpu);
+	}
+	return cpus;
+}
+
+static Affinity single_cpu(unsigned cpu)
+{
+	return DWORD_PTR(1) << cpu;
+}
+#else
+// no affinity control, pinning does nothing
+typedef int Affinity;
+
+static Affinity current_affinity()
+{
+	return 0;
+}
+
+static void set_affinity(const Affinity&) {}
+
+static std::vector<unsigned> affinity_cpus(const Affinity&)
+{
+	return {};
+}
+
+static Affinity single_cpu(unsigned)
+{
+	return 0;
+}
+#endif
+
+ThreadPool::ThreadPool(unsigned nthreads, bool pin) : nthreads(nthreads)
+{
+	if (this->nthreads == 0) this->nthreads = std::max(1u, std::thread::hardware_concurrency());
+
+	//only the CPUs the process may run on, so that runs started on disjoint CPU sets (e.g. with taskset) stay apart
+	if (pin) cpus = affinity_cpus(current_affinity());
+
+	for (unsigned i = 1; i < this->nthreads; i++)
+	{
+		threads.emplace_back([this, i]
+			{
+				if (!cpus.empty()) set_affinity(single_cpu(cpus[i % cpus.size()]));
+				worker_loop(i);
+			}
+		);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard lk(m);
+		stopping = true;
+	}
+	start_cond.notify_all();
+
+	for (auto&& t : threads)
+	{
+		t.join();
+	}
+}
+
+void ThreadPool::run(const std::function<void(unsigned)>& f)
+{
+	{
+		std::lock_guard lk(m);
+		job = &f;
+		running = nthreads - 1;
+		generation++;
+	}
+	start_cond.notify_all();
+
+	//the calling thread is only pinned while it works as worker 0, and gets its own affinity back afterwards
+	if (cpus.empty())
+	{
+		f(0);
+	}
+	else
+	{
+		Affinity caller_affinity = current_affinity();
+		set_affinity(single_cpu(cpus[0]));
+		f(0);
+		set_affinity(caller_affinity);
+	}
+
+	std::unique_lock lk(m);
+	done_cond.wait(lk, [this] { return running == 0; });
+	job = nullptr;
+}
+
+void ThreadPool::worker_loop(unsigned index)
+{
+	uint64_t seen_generation = 0;
+	while (true)
+	{
+		const std::function<void(unsigned)>* current_job;
+		{
+			std::unique_lock lk(m);
+			start_cond.wait(lk, [&] { return stopping || generation != seen_generation; });
+			if (stopping) return;
+			seen_generation = generation;
+			current_job = job;
+		}
+
+		(*current_job)(index);
+
+		{
+			std::lock_guard lk(m);
+			if (--running == 0) done_cond.notify_one();
+		}
+	}
+}
+
+ThreadPool& ThreadPool::global()
+{
+	if (!global_pool) global_pool = std::make_unique<ThreadPool>();
+	return *global_pool;
+}
+
+void ThreadPool::configure_global(unsigned nthreads, bool pin)
+{
+	global_pool = std::make_unique<ThreadPool>(nthreads, pin);
+}
@@ -1,47 +1,137 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
 #include <concepts>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
+#include <functional>
 #include <iterator>
+#include <memory>
+#include <mutex>
 #include <thread>
 #include <vector>
 
-template<std::random_access_iterator It, std::invocable<std::iter_value_t<It>> F>
-void parallel_for(It first, It last, F f)
+// A fixed set of worker threads, reused by every parallel_for. The thread calling run takes part as worker 0.
+class ThreadPool
 {
-	int nthreads = std::thread::hardware_concurrency();
+public:
+	// nthreads = 0 uses all hardware threads. pin binds worker i to the i-th of the logical CPUs the process may run
+	// on, wrapping around when there are more workers than CPUs; the calling thread, worker 0, is only bound to the
+	// first of them for the duration of run().
+	explicit ThreadPool(unsigned nthreads = 0, bool pin = false);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
 
-	auto work_func = [&](It thread_first, It thread_last) 
+	unsigned size() const
 	{
-		std::for_each(thread_first, thread_last, f);
+		return nthreads;
+	}
+
+	// calls f(worker_index) on every worker and waits for all of them to return
+	void run(const std::function<void(unsigned)>& f);
+
+	// pool used by parallel_for unless told otherwise, created on first use
+	static ThreadPool& global();
+	// replaces the global pool, call this before anything else is running on it
+	static void configure_global(unsigned nthreads, bool pin);
+
+private:
+	unsigned nthreads;
+	std::vector<std::thread> threads;
+	// the CPUs workers are pinned to, empty when they are not
+	std::vector<unsigned> cpus;
+
+	std::mutex m;
+	std::condition_variable start_cond, done_cond;
+	const std::function<void(unsigned)>* job = nullptr;
+	uint64_t generation = 0;
+	unsigned running = 0;
+	bool stopping = false;
+
+	void worker_loop(unsigned index);
+
+	static std::unique_ptr<ThreadPool> global_pool;
+};
+
+namespace detail
+{
+	// range of item indices still to be processed by one worker; the owner takes chunks from the front, thieves take the back half
+	struct alignas(64) WorkRange
+	{
+		std::mutex m;
+		std::ptrdiff_t begin = 0, end = 0;
 	};
+}
+
+// Calls f on every element of [first, last). Each worker starts on its own contiguous slice, processes it
+// grain items at a time, and steals half of the remaining work of another worker once its slice runs out.
+template<std::random_access_iterator It, std::invocable<std::iter_value_t<It>> F>
+void parallel_for(It first, It last, F f, ThreadPool& pool = ThreadPool::global(), std::ptrdiff_t grain = 0)
+{
+	std::ptrdiff_t n = std::distance(first, last);
+	std::ptrdiff_t nthreads = pool.size();
 
+	if (n <= 0) return;
 	if (nthreads == 1)
 	{
-		work_func(first, last);
+		std::for_each(first, last, f);
 		return;
 	}
 
-	auto n = std::distance(first, last);
-	auto work_size = n / (nthreads - 1);
+	if (grain <= 0) grain = std::max<std::ptrdiff_t>(1, n / (nthreads * 256));
 
-	std::vector<std::pair<It, It>> work_ranges;
-	for (decltype(n) i = 0; i < nthreads - 1; i++)
+	std::vector<detail::WorkRange> ranges(nthreads);
+	for (std::ptrdiff_t t = 0; t < nthreads; t++)
 	{
-		work_ranges.push_back({ first + i * work_size, first + (i + 1) * work_size });
+		ranges[t].begin = n * t / nthreads;
+		ranges[t].end = n * (t + 1) / nthreads;
 	}
-	work_ranges.push_back({ first + (nthreads - 1) * work_size, last });
 
-	std::vector<std::thread> threads;
-	for (const auto& r: work_ranges)
-	{
-		auto [thread_first, thread_last] = r;
-		threads.emplace_back(work_func, thread_first, thread_last);
-	}
+	pool.run([&](unsigned worker)
+		{
+			auto& own = ranges[worker];
+			while (true)
+			{
+				std::ptrdiff_t chunk_first, chunk_last;
+				{
+					std::lock_guard lk(own.m);
+					chunk_first = own.begin;
+					chunk_last = std::min(own.end, own.begin + grain);
+					own.begin = chunk_last;
+				}
 
-	for (auto&& t : threads) 
-	{
-		t.join();
-	}
-}
\ No newline at end of file
+				if (chunk_first < chunk_last)
+				{
+					for (auto i = chunk_first; i < chunk_last; i++) f(first[i]);
+					continue;
+				}
+
+				// out of work, look for a victim; work in transit between workers is never lost, only not stolen
+				bool stole = false;
+				for (std::ptrdiff_t v = 1; v < nthreads && !stole; v++)
+				{
+					auto& victim = ranges[(worker + v) % nthreads];
+					std::ptrdiff_t stolen_first, stolen_last;
+					{
+						std::lock_guard lk(victim.m);
+						if (victim.begin >= victim.end) continue;
+						stolen_first = victim.begin + (victim.end - victim.begin) / 2;
+						stolen_last = victim.end;
+						victim.end = stolen_first;
+					}
+					std::lock_guard lk(own.m);
+					own.begin = stolen_first;
+					own.end = stolen_last;
+					stole = true;
+				}
+
+				if (!stole) break;
+			}
+		}
+	);
+}
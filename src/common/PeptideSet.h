@@ -1,8 +1,11 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <span>
 #include <string>
 #include <stdexcept>
 #include <vector>
@@ -36,6 +39,9 @@ public:
 
 class PeptideSet : public std::vector<Peptide>
 {
+	// residue codes of every peptide followed by those of its reversed sequence, see encode()
+	std::vector<uint8_t> codes;
+	size_t stride = 0;
 
 public:
 	PeptideSet() {}
@@ -46,4 +52,33 @@ public:
 
 	void read(std::filesystem::path path);
 	void write(std::string_view path);
+
+	// fills the arena with the codes of every peptide and of its reversed sequence, each of them preceded by
+	// padding gap codes and followed by as many gaps as needed to make all the entries equally long
+	template<typename EncodeResidue>
+	void encode(EncodeResidue encode_residue, uint8_t gap_code, size_t padding)
+	{
+		size_t max_length = 0;
+		for (auto&& peptide : *this) max_length = std::max(max_length, peptide.sequence.length());
+
+		stride = max_length + 2 * padding;
+		codes.assign(2 * size() * stride, gap_code);
+
+		for (size_t i = 0; i < size(); i++)
+		{
+			auto& sequence = (*this)[i].sequence;
+			uint8_t* forward = codes.data() + 2 * i * stride + padding;
+			uint8_t* reversed = forward + stride;
+			for (size_t p = 0; p < sequence.length(); p++)
+			{
+				forward[p] = reversed[sequence.length() - 1 - p] = encode_residue(sequence[p]);
+			}
+		}
+	}
+
+	// padded residue codes of a peptide, valid until the set is modified
+	std::span<const uint8_t> encoded(size_t index, bool reversed = false) const
+	{
+		return { codes.data() + (2 * index + reversed) * stride, stride };
+	}
 };
\ No newline at end of file
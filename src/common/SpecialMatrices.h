@@ -2,8 +2,72 @@
 
 #include <MemoryMappedMatrix.h>
 
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
 #include <string_view>
 
+using score_t = float;
+
+// One pair of the combined output: the score, and a code byte with the orientation in the low two bits
+// and the alignment, a signed number of residues in [-31, 31], in the upper six.
+#pragma pack(push, 1)
+struct PairRecord
+{
+	score_t score;
+	uint8_t code;
+
+	static constexpr int max_alignment = 31;
+
+	static PairRecord make(score_t score, uint8_t orientation, int alignment) {
+		return { score, uint8_t((alignment << 2) | (orientation & 3)) };
+	}
+
+	uint8_t orientation() const {
+		return code & 3;
+	}
+
+	int alignment() const {
+		return int8_t(code) >> 2;
+	}
+
+	// the record of the pair in the opposite order
+	PairRecord transposed() const {
+		return make(score, orientation(), -alignment());
+	}
+};
+#pragma pack(pop)
+
+// What a sparse file adds to the FileHeader, see MatrixFlags::sparse.
+struct SparseHeader
+{
+	score_t cutoff;
+	uint32_t reserved;
+	uint64_t entries;
+};
+
+// One pair of a sparse file, in the row given by the row starts.
+struct SparseEntry
+{
+	uint32_t col;
+	score_t score;
+	int32_t alignment;
+	uint8_t orientation;
+	uint8_t reserved[3];
+};
+
+inline SparseHeader read_sparse_header(std::string_view path)
+{
+	SparseHeader header{};
+	std::ifstream input{ std::string(path), std::ios::binary };
+	input.seekg(sizeof(FileHeader));
+	input.read(reinterpret_cast<char*>(&header), sizeof(header));
+	return header;
+}
+
 template<typename T>
 struct SquareMatrix
 {
@@ -24,14 +88,71 @@ struct SquareMatrix
 		size_t n = src.get_dimensions().first;
 		SquareMatrix<U> dst(n);
 		
-		memcpy(dst[0], src[0], n * n * sizeof(T));
+		if (!src.is_packed()) {
+			memcpy(dst[0], src[0], n * n * sizeof(T));
+		}
+		else {
+			for (size_t i = 0; i < n; i++) {
+				memcpy(dst[i], src[i], (i + 1) * sizeof(T));
+				for (size_t j = 0; j < i; j++) {
+					dst[j][i] = src.get(j, i);
+				}
+			}
+		}
+
+		return dst;
+	}
+
+	// the scores of a combined record file
+	static SquareMatrix from_records(std::string_view path) {
+		MemoryMappedMatrix<PairRecord> src(path);
+
+		size_t n = src.get_dimensions().first;
+		SquareMatrix dst(n);
+
+		for (size_t i = 0; i < n; i++) {
+			for (size_t j = 0; j <= i; j++) {
+				dst[i][j] = dst[j][i] = src[i][j].score;
+			}
+		}
 
 		return dst;
 	}
 
-	void to_binary(std::string_view path) const {
-		MemoryMappedMatrix<T> dst(path, n, n);
-		memcpy(dst[0], ptr, n * n * sizeof(T));
+	// the scores of a square sparse file; the pairs it leaves out score at least its cutoff and get +infinity
+	static SquareMatrix from_sparse(std::string_view path) {
+		MemoryMapped file(path);
+		auto header = reinterpret_cast<const FileHeader*>(file.getData());
+		size_t n = header->n;
+		bool packed = header->flags & MatrixFlags::packed;
+		if (header->m != n) throw std::runtime_error("sparse matrix is not square");
+
+		auto row_start = reinterpret_cast<const uint64_t*>(file.getData() + header->offset);
+		auto entries = reinterpret_cast<const SparseEntry*>(row_start + n + 1);
+
+		SquareMatrix dst(n);
+		std::fill(dst[0], dst[0] + n * n, std::numeric_limits<T>::infinity());
+		for (size_t i = 0; i < n; i++) {
+			for (auto entry = entries + row_start[i]; entry != entries + row_start[i + 1]; entry++) {
+				dst[i][entry->col] = entry->score;
+				if (packed) dst[entry->col][i] = entry->score;
+			}
+		}
+
+		return dst;
+	}
+
+	// with MatrixFlags::packed in flags, only the lower triangle is written
+	void to_binary(std::string_view path, uint16_t flags = 0) const {
+		MemoryMappedMatrix<T> dst(path, n, n, flags);
+		if (!dst.is_packed()) {
+			memcpy(dst[0], ptr, n * n * sizeof(T));
+		}
+		else {
+			for (size_t i = 0; i < n; i++) {
+				memcpy(dst[i], (*this)[i], (i + 1) * sizeof(T));
+			}
+		}
 	}
 
 	size_t size() const {
@@ -42,5 +163,4 @@ private:
 	T* ptr;
 };
 
-using score_t = float;
 using InteractionMatrix = SquareMatrix<score_t>;
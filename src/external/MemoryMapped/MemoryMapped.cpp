@@ -6,6 +6,8 @@
 
 #include "MemoryMapped.h"
 
+#include <algorithm>
+
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -176,6 +178,30 @@ bool MemoryMapped::remap(uint64_t offset, size_t mappedBytes)
 }
 
 
+/// write modified pages in [offset, offset+numBytes) back to disk, optionally dropping them from memory
+bool MemoryMapped::flush(uint64_t offset, size_t numBytes, bool release)
+{
+	if (!_mappedView || offset >= _mappedBytes)
+		return false;
+
+	// msync and madvise want a page aligned start
+	uint64_t begin = offset - offset % getpagesize();
+	size_t length = size_t(std::min<uint64_t>(offset + numBytes, _mappedBytes) - begin);
+	unsigned char* start = (unsigned char*)_mappedView + begin;
+
+	if (msync(start, length, MS_SYNC) != 0)
+		return false;
+
+#ifdef MADV_DONTNEED
+	// the mapping is shared, so clean pages are simply re-read from the file if touched again
+	if (release)
+		madvise(start, length, MADV_DONTNEED);
+#endif
+
+	return true;
+}
+
+
 /// get OS page size (for remap)
 int MemoryMapped::getpagesize()
 {
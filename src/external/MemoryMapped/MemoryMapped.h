@@ -65,6 +65,11 @@ public:
 
   /// replace mapping by a new one of the same file, offset MUST be a multiple of the page size
   bool remap(uint64_t offset, size_t mappedBytes);
+  /// write modified pages in [offset, offset+numBytes) back to disk, optionally dropping them from memory
+  bool flush(uint64_t offset, size_t numBytes, bool release = false);
+
+  /// get OS page size (for remap)
+  static int getpagesize();
 
 private:
   /// don't copy object
@@ -72,9 +77,6 @@ private:
   /// don't copy object
   MemoryMapped& operator=(const MemoryMapped&);
 
-  /// get OS page size (for remap)
-  static int getpagesize();
-
   /// file name
   std::string _filename;
   /// file size
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "MemoryMapped.h"
+
+#include "scoring/ScoringHelper.h"
+#include "shard.h"
+
+// A persistent cache of pair scores shared by all the runs that point --cache at the same file, so that the pairs
+// of peptides scored before with the same options are read back instead of being scored again.
+// It is an open addressing hash table in a memory mapped file. Entries are only ever added, and a slot is
+// published by writing its key last, so any number of threads and processes can read and add at the same time.
+// A slot claimed by a writer that never finished stays unusable, which only costs a little capacity.
+class PairCache
+{
+public:
+	// two independent 64 bit hashes of the scoring options and both sequences of a pair, in order
+	struct PairKey
+	{
+		uint64_t key, check;
+	};
+
+	// the two hashes of one sequence, see pair_key()
+	using SequenceHash = std::pair<uint64_t, uint64_t>;
+
+private:
+	struct Header
+	{
+		char magic[16];
+		uint64_t capacity;
+		uint64_t count;
+		uint64_t reserved[4];
+	};
+
+	struct Slot
+	{
+		uint64_t key, check;
+		ScoringOptions::aligned_oriented_score_t value;
+	};
+
+	// keys of the slots that hold nothing yet and of those a writer is filling
+	static constexpr uint64_t empty = 0, busy = 1;
+	// slots probed for a key before giving up, and the fill at which no more entries are added
+	static constexpr size_t max_probes = 64;
+	static constexpr double max_load = 0.75;
+	static constexpr const char* magic = "fastscore cache";
+
+	MemoryMapped file;
+	Header* header = nullptr;
+	Slot* slots = nullptr;
+	uint64_t mask = 0, config_hash;
+	std::atomic<uint64_t> hits{ 0 }, misses{ 0 }, dropped{ 0 };
+
+	static uint64_t mix(uint64_t x)
+	{
+		x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ull;
+		x ^= x >> 27; x *= 0x94d049bb133111ebull;
+		return x ^ (x >> 31);
+	}
+
+	static std::atomic_ref<uint64_t> key_of(Slot& slot)
+	{
+		return std::atomic_ref<uint64_t>(slot.key);
+	}
+
+public:
+	// opens the cache at path, creating one of about size bytes if there is none yet; entries scored
+	// with options other than config are kept apart from those of this run
+	PairCache(const std::filesystem::path& path, size_t size, std::string_view config) : config_hash(fnv1a(config))
+	{
+		if (!std::filesystem::exists(path))
+		{
+			// built aside and linked into place, so that of several runs creating the cache at once, one wins
+			auto tmp_path = path;
+			tmp_path += "." + std::to_string(std::random_device{}()) + ".tmp";
+			{
+				uint64_t slot_count = 1;
+				while (2 * slot_count * sizeof(Slot) <= size) slot_count *= 2;
+				MemoryMapped tmp(tmp_path.string(), sizeof(Header) + slot_count * sizeof(Slot));
+				if (!tmp.isValid())
+					throw std::runtime_error("can not create the cache " + path.string());
+				auto tmp_header = reinterpret_cast<Header*>(tmp.getData());
+				strcpy(tmp_header->magic, magic);
+				tmp_header->capacity = slot_count;
+				tmp.flush(0, sizeof(Header));
+			}
+			std::error_code error;
+			std::filesystem::create_hard_link(tmp_path, path, error);
+			std::filesystem::remove(tmp_path);
+		}
+
+		file.open(path.string());
+		if (!file.isValid() || file.size() < sizeof(Header))
+			throw std::runtime_error("can not map the cache " + path.string());
+
+		header = reinterpret_cast<Header*>(file.getData());
+		slots = reinterpret_cast<Slot*>(file.getData() + sizeof(Header));
+
+		auto capacity_in_file = header->capacity;
+		if (strncmp(header->magic, magic, sizeof(header->magic)) != 0 || (capacity_in_file & (capacity_in_file - 1)) != 0 ||
+			file.size() != sizeof(Header) + capacity_in_file * sizeof(Slot))
+			throw std::runtime_error(path.string() + " is not a cache written by this version of fastscore");
+		mask = capacity_in_file - 1;
+	}
+
+	SequenceHash sequence_hash(std::string_view sequence) const
+	{
+		return { fnv1a(sequence, config_hash), fnv1a(sequence, mix(config_hash)) };
+	}
+
+	static PairKey pair_key(SequenceHash first, SequenceHash second)
+	{
+		uint64_t key = mix(first.first ^ mix(second.first + 0x9e3779b97f4a7c15ull));
+		uint64_t check = mix(first.second + mix(second.second ^ 0x9e3779b97f4a7c15ull));
+		return { key > busy ? key : key + 2, check };
+	}
+
+	bool find(PairKey pair, ScoringOptions::aligned_oriented_score_t& value) const
+	{
+		for (size_t probe = 0; probe < max_probes; probe++)
+		{
+			Slot& slot = slots[(pair.key + probe) & mask];
+			auto key = key_of(slot).load(std::memory_order_acquire);
+			if (key == empty) return false;
+			if (key == pair.key && slot.check == pair.check)
+			{
+				value = slot.value;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void insert(PairKey pair, const ScoringOptions::aligned_oriented_score_t& value)
+	{
+		if (std::atomic_ref<uint64_t>(header->count).load(std::memory_order_relaxed) >= max_load * (mask + 1))
+		{
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		for (size_t probe = 0; probe < max_probes; probe++)
+		{
+			Slot& slot = slots[(pair.key + probe) & mask];
+			auto key = key_of(slot).load(std::memory_order_acquire);
+			if (key == pair.key && slot.check == pair.check) return;
+			if (key != empty || !key_of(slot).compare_exchange_strong(key, busy, std::memory_order_acquire)) continue;
+
+			slot.check = pair.check;
+			slot.value = value;
+			key_of(slot).store(pair.key, std::memory_order_release);
+			std::atomic_ref<uint64_t>(header->count).fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		dropped.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// lookups of this run, counted per batch by the caller
+	void count(size_t batch_hits, size_t batch_misses)
+	{
+		hits.fetch_add(batch_hits, std::memory_order_relaxed);
+		misses.fetch_add(batch_misses, std::memory_order_relaxed);
+	}
+
+	uint64_t hit_count() const { return hits; }
+	uint64_t miss_count() const { return misses; }
+	// entries this run could not add because the cache was full
+	uint64_t dropped_count() const { return dropped; }
+	uint64_t size() const { return std::atomic_ref<uint64_t>(header->count).load(); }
+	uint64_t capacity() const { return mask + 1; }
+
+	void flush()
+	{
+		file.flush(0, file.mappedSize());
+	}
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "tiles.h"
+
+// Records which tiles of a streamed run are already on disk, so that an interrupted run can skip them.
+// It is only saved after the outputs were flushed, and always through a rename, so it never claims more than they hold.
+class Checkpoint
+{
+	std::filesystem::path path;
+	std::string config;
+	size_t n;
+	std::vector<char> done;
+
+	static constexpr const char* magic = "fastscore checkpoint 1";
+
+public:
+	Checkpoint(std::filesystem::path path, std::string config, size_t n) :
+		path(std::move(path)), config(std::move(config)), n(n), done(tile_index({ tile_rows(n), 0 }), '0') {}
+
+	// false if there is no checkpoint, or it belongs to a run with a different input or options
+	bool load()
+	{
+		std::ifstream in(path);
+		std::string line, saved_config, saved_done;
+		size_t saved_n = 0, saved_tile_size = 0;
+
+		if (!std::getline(in, line) || line != magic) return false;
+		if (!std::getline(in, saved_config) || saved_config != config) return false;
+		if (!(in >> saved_n >> saved_tile_size >> saved_done)) return false;
+		if (saved_n != n || saved_tile_size != tile_size || saved_done.size() != done.size()) return false;
+
+		done.assign(saved_done.begin(), saved_done.end());
+		return true;
+	}
+
+	void save() const
+	{
+		auto tmp_path = path;
+		tmp_path += ".tmp";
+		{
+			std::ofstream out(tmp_path, std::ios::trunc);
+			out << magic << '\n' << config << '\n' << n << ' ' << tile_size << '\n';
+			out.write(done.data(), done.size());
+			out << '\n';
+		}
+		std::filesystem::rename(tmp_path, path);
+	}
+
+	bool is_done(Tile tile) const
+	{
+		return done[tile_index(tile)] == '1';
+	}
+
+	void mark_done(std::span<const Tile> tiles)
+	{
+		for (auto& tile : tiles) done[tile_index(tile)] = '1';
+	}
+};
@@ -3,17 +3,26 @@
 #include <iostream>
 #include <atomic>
 #include <chrono>
+#include <functional>
+#include <memory>
+#include <optional>
 #include <thread>
 
+#include "cache.h"
+#include "checkpoint.h"
 #include "io.h"
 #include "options.h"
+#include "shard.h"
+#include "tiles.h"
 
 #include "scoring/ScoringHelper.h"
 #include "scoring/ScoringEnginePotapov.h"
 #include "scoring/ScoringEngineBCIPA.h"
 #include "scoring/ScoringEngineQCIPA.h"
 #include "scoring/ScoringEngineICIPA.h"
+#include "scoring/HeptadBlockScorer.h"
 
+#include "common/MemoryMappedMatrix.h"
 #include "common/ParallelFor.h"
 #include "common/PeptideSet.h"
 #include "common/SpecialMatrices.h"
@@ -21,77 +30,484 @@
 
 using namespace std;
 
+using StoreTile = function<void(Tile, const TileScores&)>;
+using PanelDone = function<void(span<const Tile>)>;
+
 template<typename ScoringEngineType>
 void score_pairs(
 	PeptideSet& ps,
 	vector<alignment_t>& alignment,
 	bool truncate,
 	ScoringOptions::Orientation orientation,
-	InteractionMatrix& im,
-	OrientationMatrix& om,
-	AlignmentMatrix& am
+	bool heptad_tables,
+	ScoringOptions::Precision precision,
+	ScoreRegion region,
+	PairCache* cache,
+	const vector<Tile>& tiles,
+	size_t panel_height,
+	const StoreTile& store,
+	const PanelDone& panel_done
 ) {
-	ScoringHelper<ScoringEngineType> sc{};
-	auto n = ps.size();
-	int items_to_process = n * (n + 1) / 2;
-	int items_processed_total = 0, items_processed_prev = 0;
-	int reporting_interval = items_to_process / 100;
-
+	auto sc = [precision] {
+		if constexpr (is_same_v<ScoringEngineType, ScoringEnginePotapov>) return ScoringHelper<ScoringEngineType>{ precision };
+		else return ScoringHelper<ScoringEngineType>{};
+	}();
 	auto start = chrono::high_resolution_clock::now();
-	auto time_prev = start;
 
-	auto indices = TriangularIndices(n);
-	parallel_for(indices.begin(), indices.end(), [&](auto idx) 
+	sc.encode(ps);
+
+	optional<HeptadBlockScorer> heptad_scorer;
+	if constexpr (is_same_v<ScoringEngineType, ScoringEnginePotapov>) {
+		if (precision != ScoringOptions::Precision::float32) {
+			size_t max_length = 0;
+			for (auto& peptide : ps) max_length = max(max_length, peptide.sequence.length());
+			cout << "Quantized scores differ from the float ones by at most " << sc.sc.max_error(max_length + 2 * sc.max_displacement) << "\n";
+		}
+		if (heptad_tables) {
+			heptad_scorer = HeptadBlockScorer::build(sc.sc, ps, alignment, truncate);
+			if (heptad_scorer) cout << "Built heptad tables for " << heptad_scorer->heptad_count() << " distinct heptads\n";
+			else cout << "The peptides or alignments are not made of whole heptads, scoring them residue by residue\n";
+		}
+	}
+
+	vector<PairCache::SequenceHash> sequence_hashes;
+	if (cache) {
+		for (auto& peptide : ps) sequence_hashes.push_back(cache->sequence_hash(peptide.sequence));
+	}
+
+	// scores peptide i against the peptides [first, last) of the set
+	auto score_row = [&](size_t i, size_t first, size_t last, ScoringOptions::aligned_oriented_score_t* out) {
+		if (heptad_scorer) {
+			for (size_t j = first; j < last; j++) out[j - first] = heptad_scorer->score(i, j, orientation);
+		}
+		else {
+			sc.score_batch(ps, i, first, last, alignment, truncate, orientation, out);
+		}
+	};
+
+	// reads what the cache has and scores the runs of pairs in between, adding them to the cache
+	auto score_row_cached = [&](size_t i, size_t first, size_t last, ScoringOptions::aligned_oriented_score_t* out) {
+		size_t hits = 0;
+		for (size_t j = first; j < last;)
 		{
-			auto [i, j] = idx;
-			auto score = sc.score(ps[i].sequence, ps[j].sequence, alignment, truncate, orientation);
-			im[i][j] = im[j][i] = score.score;
-			om[i][j] = om[j][i] = score.orientation;
-			am[i][j] = score.alignment; am[j][i] = -score.alignment;
+			auto miss = j;
+			while (j < last && !cache->find(PairCache::pair_key(sequence_hashes[i], sequence_hashes[j]), out[j - first])) j++;
+			if (miss < j) {
+				score_row(i, miss, j, out + (miss - first));
+				for (auto k = miss; k < j; k++) cache->insert(PairCache::pair_key(sequence_hashes[i], sequence_hashes[k]), out[k - first]);
+			}
+			if (j < last) {
+				hits++;
+				j++;
+			}
 		}
-	);
+		cache->count(hits, last - first - hits);
+	};
+
+	auto score_tile = [&](Tile tile) {
+		static thread_local vector<ScoringOptions::aligned_oriented_score_t> row(tile_size);
+		static thread_local TileScores block;
+		size_t i0 = tile.first * tile_size, i1 = min(region.rows, i0 + tile_size);
+		size_t j0 = tile.second * tile_size, j1 = min(region.cols, j0 + tile_size);
+		auto col0 = region.col0;
+
+		for (size_t i = i0; i < i1; i++)
+		{
+			auto last = region.triangle ? min(j1, i + 1) : j1;
+			if (cache) {
+				score_row_cached(i, col0 + j0, col0 + last, row.data());
+			}
+			else {
+				score_row(i, col0 + j0, col0 + last, row.data());
+			}
+
+			size_t k = (i - i0) * tile_size;
+			for (size_t j = j0; j < last; j++, k++)
+			{
+				block.score[k] = row[j - j0].score;
+				block.orientation[k] = row[j - j0].orientation;
+				block.alignment[k] = row[j - j0].alignment;
+			}
+		}
+
+		store(tile, block);
+	};
+
+	// a panel is a run of panel_height tile rows; once it is done, its rows and the columns it mirrored into are final
+	for (auto first = tiles.begin(); first != tiles.end();)
+	{
+		auto panel = first->first / panel_height;
+		auto last = find_if(first, tiles.end(), [&](const Tile& tile) { return tile.first / panel_height != panel; });
+		parallel_for(first, last, score_tile);
+		panel_done({ first, last });
+		first = last;
+	}
 
 	auto stop = chrono::high_resolution_clock::now();
 
+	if (cache) {
+		cache->flush();
+		cout << "Pair cache: " << cache->hit_count() << " hits, " << cache->miss_count() << " misses, " << cache->size() << " of " << cache->capacity() << " slots used";
+		if (cache->dropped_count() > 0) cout << ", " << cache->dropped_count() << " new pairs did not fit";
+		cout << "\n";
+	}
+
 	cout << "Done in " << chrono::duration_cast<chrono::seconds>(stop - start).count() << " seconds" << endl;
 }
 
-int main(int argc, char **argv) {
-	Options options(argc, argv);
-	options.print_parsed();
-
-	auto& alignment = options.alignment;
+void score_all(const Options& options, PeptideSet& ps, ScoreRegion region, const vector<Tile>& tiles, size_t panel_height, const StoreTile& store, const PanelDone& panel_done)
+{
+	auto alignment = options.alignment;
 	auto truncate = options.truncate;
 	auto orientation = options.orientation;
 
-	auto fasta_path = options.fasta_path.string();
-	auto basename = options.basename;
-
-	PeptideSet ps(fasta_path);
-	InteractionMatrix im(ps.size());
-	OrientationMatrix om(ps.size());
-	AlignmentMatrix am(ps.size());
+	unique_ptr<PairCache> cache;
+	if (!options.cache_path.empty())
+	{
+		try
+		{
+			cache = make_unique<PairCache>(options.cache_path, options.cache_size, options.scoring_config());
+		}
+		catch (const exception& e)
+		{
+			cout << "Can not use the pair cache, " << e.what() << "\n";
+			exit(1);
+		}
+	}
 
 	switch (options.score_func)
 	{
 	case ScoringOptions::ScoreFunc::potapov:
-		score_pairs<ScoringEnginePotapov>(ps, alignment, truncate, orientation, im, om, am);
+		score_pairs<ScoringEnginePotapov>(ps, alignment, truncate, orientation, options.heptad_tables, options.precision, region, cache.get(), tiles, panel_height, store, panel_done);
 		break;
 	case ScoringOptions::ScoreFunc::bcipa:
-		score_pairs<ScoringEngineBCIPA>(ps, alignment, truncate, orientation, im, om, am);
+		score_pairs<ScoringEngineBCIPA>(ps, alignment, truncate, orientation, options.heptad_tables, options.precision, region, cache.get(), tiles, panel_height, store, panel_done);
 		break;
 	case ScoringOptions::ScoreFunc::qcipa:
-		score_pairs<ScoringEngineQCIPA>(ps, alignment, truncate, orientation, im, om, am);
+		score_pairs<ScoringEngineQCIPA>(ps, alignment, truncate, orientation, options.heptad_tables, options.precision, region, cache.get(), tiles, panel_height, store, panel_done);
 		break;
 	case ScoringOptions::ScoreFunc::icipa_core_vert:
-		score_pairs<ScoringEngineICIPACoreVert>(ps, alignment, truncate, orientation, im, om, am);
+		score_pairs<ScoringEngineICIPACoreVert>(ps, alignment, truncate, orientation, options.heptad_tables, options.precision, region, cache.get(), tiles, panel_height, store, panel_done);
 		break;
 	case ScoringOptions::ScoreFunc::icipa_nter_core:
-		score_pairs<ScoringEngineICIPANterCore>(ps, alignment, truncate, orientation, im, om, am);
+		score_pairs<ScoringEngineICIPANterCore>(ps, alignment, truncate, orientation, options.heptad_tables, options.precision, region, cache.get(), tiles, panel_height, store, panel_done);
 		break;
 	}
+}
+
+// scoring options plus a hash of the input, identifying the results of a run
+string run_config(const Options& options, const PeptideSet& ps)
+{
+	uint64_t peptides_hash = fnv1a(to_string(ps.size()));
+	for (auto& peptide : ps)
+	{
+		peptides_hash = fnv1a(peptide.sequence + '\n', peptides_hash);
+	}
+	return options.scoring_config() + " peptides=" + to_string(peptides_hash);
+}
+
+// Scores straight into memory mapped output files. Half the memory budget goes to the full rows of a panel, the
+// other half to mirroring them into the strip of columns they make in all the rows above, see finish_rows().
+// Only those rows are written back and released after every panel.
+// The tiles of each finished panel are recorded in a checkpoint next to the outputs, which --resume picks up.
+void score_streaming(const Options& options, PeptideSet& ps)
+{
+	auto n = ps.size();
+	auto& basename = options.basename;
+	auto format = options.output_format;
+
+	Checkpoint checkpoint(basename + ".checkpoint", run_config(options, ps), n);
+
+	bool resume = false;
+	if (options.resume)
+	{
+		auto paths = MappedOutputs::paths(basename, format);
+		resume = all_of(paths.begin(), paths.end(), [](auto& path) { return fs::exists(path); }) && checkpoint.load();
+		cout << (resume ? "Resuming from " : "No usable checkpoint at ") << basename << ".checkpoint" << (resume ? "\n" : ", starting over\n");
+	}
+
+	// only complete outputs are recorded, see write_config_hash
+	fs::remove(basename + ".config");
+	unique_ptr<MappedOutputs> outputs;
+	try
+	{
+		outputs = make_unique<MappedOutputs>(basename, n, format, resume);
+	}
+	catch (const exception& e)
+	{
+		cout << "Can not resume, " << e.what() << "\n";
+		exit(1);
+	}
+
+	vector<Tile> tiles;
+	for (auto& tile : all_tiles(n))
+	{
+		if (!checkpoint.is_done(tile)) tiles.push_back(tile);
+	}
+	if (resume)
+	{
+		cout << tiles.size() << " of " << tile_index({ tile_rows(n), 0 }) << " tiles left to score\n";
+	}
+
+	// an empty input has empty rows
+	size_t panel_rows = options.memory_budget / max<size_t>(1, 2 * MappedOutputs::row_bytes(n, format));
+	size_t panel_height = max<size_t>(1, panel_rows / tile_size);
+
+	auto store = [&](Tile tile, const TileScores& block) {
+		outputs->store(tile, block);
+	};
+	score_all(options, ps, ScoreRegion::lower_triangle(n), tiles, panel_height, store, [&](span<const Tile> panel) {
+		auto [first, last] = peptide_rows(panel, n);
+		outputs->finish_rows(first, last, options.memory_budget / 2);
+		checkpoint.mark_done(panel);
+		checkpoint.save();
+	});
+	write_config_hash(basename, fnv1a(run_config(options, ps)));
+}
+
+// Scores the tiles of one shard into its own file, see shard.h. The shard file is flushed after every panel,
+// so resident memory stays within the budget no matter how large the full matrices would be.
+void score_shard(const Options& options, PeptideSet& ps)
+{
+	auto n = ps.size();
+	auto shard = options.shard, shards = options.shards;
+	auto path = shard_path(options.basename, shard, shards);
+
+	size_t max_alignment = 0;
+	for (auto a : options.alignment) max_alignment = max<size_t>(max_alignment, abs(a));
+	ShardFile file(path, n, shard, shards, fnv1a(run_config(options, ps)), max_alignment);
+
+	vector<Tile> tiles;
+	for (auto& tile : all_tiles(n))
+	{
+		if (shard_of(tile, shards) == shard) tiles.push_back(tile);
+	}
+	cout << "Scoring " << tiles.size() << " tiles into " << path << "\n";
+
+	size_t panel_height = max<size_t>(1, options.memory_budget * shards / (tile_rows(n) * sizeof(ShardTile)));
+
+	auto store = [&](Tile tile, const TileScores& block) {
+		auto& record = file[position_in_shard(tile, shards)];
+		record.row = tile.first;
+		record.col = tile.second;
+		record.scores = block;
+		record.stored = 1;
+	};
+	score_all(options, ps, ScoreRegion::lower_triangle(n), tiles, panel_height, store, [&](span<const Tile>) {
+		file.flush(true);
+	});
+}
+
+// Scores every query peptide against every library one into n x m memory mapped outputs, rows following the
+// query fasta and columns the library one. The library is appended to the query set so that both share one
+// encoding; only the rectangle between them is scored, a panel at a time within the memory budget.
+void score_against(const Options& options, PeptideSet& ps)
+{
+	auto n = ps.size();
+	ps.read(options.against_path);
+	auto m = ps.size() - n;
+	auto& basename = options.basename;
+
+	MemoryMappedMatrix<score_t> im(basename + ".bin", n, m);
+	MemoryMappedMatrix<Orientation> om(basename + ".orientation.bin", n, m);
+	MemoryMappedMatrix<alignment_t> am(basename + ".align.bin", n, m);
+
+	cout << "Scoring " << n << " query peptides against " << m << " library peptides\n";
+
+	// with an empty library, the n x 0 outputs only get their headers
+	size_t panel_rows = options.memory_budget / max<size_t>(1, MappedOutputs::row_bytes(m, OutputFormat::binary));
+	size_t panel_height = max<size_t>(1, panel_rows / tile_size);
+
+	auto store = [&](Tile tile, const TileScores& block) {
+		store_rect_tile(n, m, tile, block, im, om, am);
+	};
+	score_all(options, ps, ScoreRegion::rectangle(n, m), rect_tiles(n, m), panel_height, store, [&](span<const Tile> panel) {
+		auto [first, last] = peptide_rows(panel, n);
+		im.flush_rows(first, last, true);
+		om.flush_rows(first, last, true);
+		am.flush_rows(first, last, true);
+	});
+}
+
+// Grows the outputs of an earlier run by the peptides appended to its input. Its block is copied over in bulk
+// and only the tile rows holding new peptides are scored, so k new peptides cost O(n * k) instead of O(n^2).
+// The enlarged outputs are written next to the final ones and renamed over them once complete, which also
+// makes extending a run in place safe.
+void score_extend(const Options& options, PeptideSet& ps)
+{
+	auto n = ps.size();
+	auto& basename = options.basename;
+	auto format = options.output_format;
+
+	PeptideSet old_ps(options.extend_fasta_path);
+	auto old_n = old_ps.size();
+	bool is_prefix = old_n <= n && equal(old_ps.begin(), old_ps.end(), ps.begin(), [](const Peptide& a, const Peptide& b) {
+		return a.id == b.id && a.sequence == b.sequence;
+	});
+	if (!is_prefix)
+	{
+		cout << "The peptides of " << options.extend_fasta_path.string() << " are not the first ones of " << options.fasta_path.string() << ", can not extend\n";
+		exit(1);
+	}
+
+	auto old_paths = MappedOutputs::paths(options.extend_basename, format);
+	for (auto& path : old_paths)
+	{
+		if (!fs::exists(path))
+		{
+			cout << "Can not extend, the output " << path << " does not exist\n";
+			exit(1);
+		}
+	}
+
+	// the old outputs have to come from these options and the old input, or the new ones would mix two runs
+	auto old_config = read_config_hash(options.extend_basename);
+	if (!old_config)
+	{
+		cout << "Can not extend, " << options.extend_basename << ".config does not tell how the outputs were scored\n";
+		exit(1);
+	}
+	if (*old_config != fnv1a(run_config(options, old_ps)))
+	{
+		cout << "Can not extend, the outputs of " << options.extend_basename << " were scored with other options or another input than " << options.extend_fasta_path.string() << "\n";
+		exit(1);
+	}
+
+	auto tmp_basename = basename + ".extending";
+	unique_ptr<MappedOutputs> outputs;
+	try
+	{
+		outputs = make_unique<MappedOutputs>(tmp_basename, n, format);
+		outputs->copy_from(options.extend_basename, old_n, options.memory_budget);
+	}
+	catch (const exception& e)
+	{
+		outputs.reset();
+		for (auto& path : MappedOutputs::paths(tmp_basename, format)) fs::remove(path);
+		cout << "Can not extend, " << e.what() << "\n";
+		exit(1);
+	}
+
+	// the tile row holding the first new peptide rescores the old ones sharing it, which write the same values
+	vector<Tile> tiles;
+	for (auto& tile : all_tiles(n))
+	{
+		if (tile.first >= old_n / tile_size) tiles.push_back(tile);
+	}
+	cout << "Reusing the scores of " << old_n << " peptides, scoring " << n - old_n << " new ones in " << tiles.size() << " tiles\n";
+
+	size_t panel_rows = options.memory_budget / max<size_t>(1, 2 * MappedOutputs::row_bytes(n, format));
+	size_t panel_height = max<size_t>(1, panel_rows / tile_size);
+
+	auto store = [&](Tile tile, const TileScores& block) {
+		outputs->store(tile, block);
+	};
+	score_all(options, ps, ScoreRegion::lower_triangle(n), tiles, panel_height, store, [&](span<const Tile> panel) {
+		auto [first, last] = peptide_rows(panel, n);
+		outputs->finish_rows(first, last, options.memory_budget / 2);
+	});
+	outputs.reset();
+
+	auto tmp_paths = MappedOutputs::paths(tmp_basename, format), paths = MappedOutputs::paths(basename, format);
+	fs::remove(basename + ".config");
+	for (size_t k = 0; k < paths.size(); k++) fs::rename(tmp_paths[k], paths[k]);
+	write_config_hash(basename, fnv1a(run_config(options, ps)));
+}
+
+// Writes only the pairs scoring below --sparse-below, see SparseOutput. The panels are sized for the worst case
+// of every pair of their rows making it in; with --against, the rows are the query peptides.
+void score_sparse(const Options& options, PeptideSet& ps)
+{
+	auto region = ScoreRegion::lower_triangle(ps.size());
+	if (!options.against_path.empty())
+	{
+		auto n = ps.size();
+		ps.read(options.against_path);
+		region = ScoreRegion::rectangle(n, ps.size() - n);
+	}
+	auto path = options.basename + ".sparse.bin";
+
+	unique_ptr<SparseOutput> output;
+	try
+	{
+		output = make_unique<SparseOutput>(path, region, *options.sparse_below);
+	}
+	catch (const exception& e)
+	{
+		cout << "Can not write the sparse output, " << e.what() << "\n";
+		exit(1);
+	}
+
+	// without columns there is nothing to score, and close() writes a file of empty rows
+	size_t panel_rows = options.memory_budget / max<size_t>(1, region.cols * sizeof(SparseEntry));
+	size_t panel_height = max<size_t>(1, panel_rows / tile_size);
+
+	auto tiles = region.triangle ? all_tiles(region.rows) : rect_tiles(region.rows, region.cols);
+	auto store = [&](Tile tile, const TileScores& block) {
+		output->store(tile, block);
+	};
+	score_all(options, ps, region, tiles, panel_height, store, [&](span<const Tile> panel) {
+		output->write_rows(panel);
+	});
+	output->close();
+
+	size_t pairs = region.triangle ? region.rows * (region.rows + 1) / 2 : region.rows * region.cols;
+	cout << "Wrote " << output->entry_count() << " of " << pairs << " pairs to " << path << "\n";
+}
+
+int main(int argc, char **argv) {
+	Options options(argc, argv);
+	options.print_parsed();
+
+	ThreadPool::configure_global(options.threads, options.pin_threads);
+
+	auto fasta_path = options.fasta_path.string();
+	auto basename = options.basename;
+
+	PeptideSet ps(fasta_path);
+
+	if (options.sparse_below)
+	{
+		score_sparse(options, ps);
+		return 0;
+	}
+
+	if (!options.against_path.empty())
+	{
+		score_against(options, ps);
+		return 0;
+	}
+
+	if (!options.extend_basename.empty())
+	{
+		score_extend(options, ps);
+		return 0;
+	}
+
+	if (options.shards > 0)
+	{
+		score_shard(options, ps);
+		return 0;
+	}
+
+	if (options.stream)
+	{
+		score_streaming(options, ps);
+		return 0;
+	}
+
+	InteractionMatrix im(ps.size());
+	OrientationMatrix om(ps.size());
+	AlignmentMatrix am(ps.size());
+
+	auto store = [&](Tile tile, const TileScores& block) {
+		store_tile(ps.size(), tile, block, im, om, am);
+	};
+	score_all(options, ps, ScoreRegion::lower_triangle(ps.size()), all_tiles(ps.size()), numeric_limits<size_t>::max(), store, [](span<const Tile>) {});
 
+	fs::remove(basename + ".config");
 	save(options.output_format, basename, ps, im, om, am);
+	if (options.output_format != OutputFormat::csv) write_config_hash(basename, fnv1a(run_config(options, ps)));
 
 	return 0;
 }
\ No newline at end of file
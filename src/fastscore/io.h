@@ -1,15 +1,27 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <filesystem>
 #include <format>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
 #include <string>
 
+#include "common/MemoryMappedMatrix.h"
 #include "common/PeptideSet.h"
 #include "common/SpecialMatrices.h"
 #include "scoring/ScoringHelper.h"
 
+#include "tiles.h"
+
 enum class OutputFormat
 {
-	binary, csv
+	binary, packed, records, csv
 };
 
 using ScoringOptions::Orientation;
@@ -53,16 +65,40 @@ void save_csv(
 	}
 }
 
+// FileHeader flags of the binary outputs; only the alignment matrix is antisymmetric
+uint16_t output_flags(OutputFormat outputFormat, bool antisymmetric = false)
+{
+	if (outputFormat != OutputFormat::packed) return 0;
+	return MatrixFlags::packed | (antisymmetric ? MatrixFlags::antisymmetric : 0);
+}
+
 void save_bin(
 	const std::string& basename,
 	const PeptideSet& peptideSet,
 	const InteractionMatrix& interactionMatrix,
 	const OrientationMatrix& orientationMatrix,
-	const AlignmentMatrix& alignmentMatrix) 
+	const AlignmentMatrix& alignmentMatrix,
+	OutputFormat outputFormat = OutputFormat::binary)
+{
+	interactionMatrix.to_binary(basename + ".bin", output_flags(outputFormat));
+	orientationMatrix.to_binary(basename + ".orientation.bin", output_flags(outputFormat));
+	alignmentMatrix.to_binary(basename + ".align.bin", output_flags(outputFormat, true));
+}
+
+// the combined output: one packed file of PairRecords instead of the three matrices
+void save_records(
+	const std::string& basename,
+	const InteractionMatrix& interactionMatrix,
+	const OrientationMatrix& orientationMatrix,
+	const AlignmentMatrix& alignmentMatrix)
 {
-	interactionMatrix.to_binary(basename + ".bin");
-	orientationMatrix.to_binary(basename + ".orientation.bin");
-	alignmentMatrix.to_binary(basename + ".align.bin");
+	size_t n = interactionMatrix.size();
+	MemoryMappedMatrix<PairRecord> records(basename + ".records.bin", n, n, MatrixFlags::packed | MatrixFlags::records);
+	for (size_t i = 0; i < n; i++) {
+		for (size_t j = 0; j <= i; j++) {
+			records[i][j] = PairRecord::make(interactionMatrix[i][j], uint8_t(orientationMatrix[i][j]), alignmentMatrix[i][j]);
+		}
+	}
 }
 
 void save(OutputFormat outputFormat,
@@ -73,10 +109,274 @@ void save(OutputFormat outputFormat,
 	const AlignmentMatrix& alignmentMatrix) {
 	switch (outputFormat) {
 		case OutputFormat::binary:
-			save_bin(basename, peptideSet, interactionMatrix, orientationMatrix, alignmentMatrix);
+		case OutputFormat::packed:
+			save_bin(basename, peptideSet, interactionMatrix, orientationMatrix, alignmentMatrix, outputFormat);
+			break;
+		case OutputFormat::records:
+			save_records(basename, interactionMatrix, orientationMatrix, alignmentMatrix);
 			break;
 		case OutputFormat::csv:
 			save_csv(basename, peptideSet, interactionMatrix, orientationMatrix, alignmentMatrix);
 			break;
 	}
-}
\ No newline at end of file
+}
+
+// The binary outputs at basename are recorded in basename.config with the hash of the options and input that
+// scored them, so that --extend only builds on outputs scored the same way.
+void write_config_hash(const std::string& basename, uint64_t hash)
+{
+	std::ofstream(basename + ".config") << hash << "\n";
+}
+
+std::optional<uint64_t> read_config_hash(const std::string& basename)
+{
+	std::ifstream in(basename + ".config");
+	uint64_t hash;
+	if (in >> hash) return hash;
+	return std::nullopt;
+}
+
+// The binary outputs of a streaming run or a merge, mapped for writing tile by tile. Tiles only fill the lower
+// triangle; finish_rows() mirrors it into the upper one of the full outputs once a panel of rows is complete.
+class MappedOutputs
+{
+	std::unique_ptr<MemoryMappedMatrix<score_t>> im;
+	std::unique_ptr<MemoryMappedMatrix<Orientation>> om;
+	std::unique_ptr<MemoryMappedMatrix<alignment_t>> am;
+	std::unique_ptr<MemoryMappedMatrix<PairRecord>> records;
+	size_t n;
+
+	// maps an existing output when resuming, otherwise creates a fresh n x n one
+	template<typename T>
+	static std::unique_ptr<MemoryMappedMatrix<T>> open(const std::string& path, size_t n, uint16_t flags, bool resume)
+	{
+		auto output = resume ? std::make_unique<MemoryMappedMatrix<T>>(path) : std::make_unique<MemoryMappedMatrix<T>>(path, n, n, flags);
+		if (output->get_dimensions() != std::make_pair(n, n) || output->get_flags() != flags)
+			throw std::runtime_error("the output " + path + " does not match the input and format");
+		return output;
+	}
+
+	// copies the top left n x n block of an earlier output, which has to be laid out like this one, a panel of rows
+	// at a time; both sides of a panel are released before the next one, keeping within budget bytes
+	template<typename T>
+	static void copy_block(MemoryMappedMatrix<T>& to, const std::string& path, size_t n, size_t budget)
+	{
+		MemoryMappedMatrix<T> from(path);
+		if (from.get_dimensions() != std::make_pair(n, n) || from.get_flags() != to.get_flags())
+			throw std::runtime_error("the output " + path + " does not match the earlier peptides and format");
+
+		size_t panel_rows = std::max<size_t>(1, budget / std::max<size_t>(1, 2 * n * sizeof(T)));
+		for (size_t first = 0; first < n; first += panel_rows) {
+			size_t last = std::min(n, first + panel_rows);
+			// the packed rows of the first n peptides are a prefix of the packed rows of all of them
+			if (to.is_packed()) {
+				std::copy_n(from[first], (last * (last + 1) - first * (first + 1)) / 2, to[first]);
+			}
+			else {
+				for (size_t i = first; i < last; i++) std::copy_n(from[i], n, to[i]);
+			}
+			to.flush_rows(first, last, true);
+			from.flush_rows(first, last, true);
+		}
+	}
+
+public:
+	static std::vector<std::string> paths(const std::string& basename, OutputFormat outputFormat)
+	{
+		if (outputFormat == OutputFormat::records) return { basename + ".records.bin" };
+		return { basename + ".bin", basename + ".orientation.bin", basename + ".align.bin" };
+	}
+
+	MappedOutputs(const std::string& basename, size_t n, OutputFormat outputFormat, bool resume = false) : n(n)
+	{
+		auto files = paths(basename, outputFormat);
+		if (outputFormat == OutputFormat::records) {
+			records = open<PairRecord>(files[0], n, MatrixFlags::packed | MatrixFlags::records, resume);
+		}
+		else {
+			im = open<score_t>(files[0], n, output_flags(outputFormat), resume);
+			om = open<Orientation>(files[1], n, output_flags(outputFormat), resume);
+			am = open<alignment_t>(files[2], n, output_flags(outputFormat, true), resume);
+		}
+	}
+
+	// bytes of one full row over all outputs
+	static size_t row_bytes(size_t n, OutputFormat outputFormat)
+	{
+		if (outputFormat == OutputFormat::records) return n * sizeof(PairRecord);
+		return n * (sizeof(score_t) + sizeof(Orientation) + sizeof(alignment_t));
+	}
+
+	void store(Tile tile, const TileScores& block)
+	{
+		if (records) {
+			store_tile_records(n, tile, block, *records);
+		}
+		else {
+			store_tile(n, tile, block, *im, *om, *am, false);
+		}
+	}
+
+	// Completes the rows [first, last) after all their tiles were stored and writes them back, releasing them. In full
+	// outputs, their columns above the diagonal are a strip of every row before last, which is filled and released a
+	// chunk of rows at a time. A chunk is sized in whole pages, counting the partial ones at either end of its strip
+	// rows, so that it dirties at most strip_budget bytes.
+	void finish_rows(size_t first, size_t last, size_t strip_budget)
+	{
+		if (im && !im->is_packed()) {
+			size_t page = MemoryMapped::getpagesize();
+			auto strip_pages = [&](size_t element_size) { return (last - first) * element_size / page + 2; };
+			size_t row_bytes = page * (strip_pages(sizeof(score_t)) + strip_pages(sizeof(Orientation)) + strip_pages(sizeof(alignment_t)));
+			size_t chunk = std::max<size_t>(1, strip_budget / row_bytes);
+
+			for (size_t j0 = 0; j0 < last; j0 += chunk) {
+				size_t j1 = std::min(last, j0 + chunk);
+				for (size_t j = j0; j < j1; j++) {
+					for (size_t i = std::max(first, j + 1); i < last; i++) {
+						(*im)[j][i] = (*im)[i][j];
+						(*om)[j][i] = (*om)[i][j];
+						(*am)[j][i] = -(*am)[i][j];
+					}
+				}
+				// the rows being finished are released below
+				if (j0 < first) flush_rows(j0, std::min(j1, first), true);
+			}
+		}
+		flush_rows(first, last, true);
+	}
+
+	void flush_rows(size_t first, size_t last, bool release = false)
+	{
+		if (records) {
+			records->flush_rows(first, last, release);
+		}
+		else {
+			im->flush_rows(first, last, release);
+			om->flush_rows(first, last, release);
+			am->flush_rows(first, last, release);
+		}
+	}
+
+	// fills the pairs of the first n peptides from the outputs of an earlier run over just them, written back as
+	// they are copied so that at most budget bytes of either are resident
+	void copy_from(const std::string& basename, size_t n, size_t budget)
+	{
+		if (records) {
+			copy_block(*records, paths(basename, OutputFormat::records)[0], n, budget);
+		}
+		else {
+			auto files = paths(basename, OutputFormat::binary);
+			copy_block(*im, files[0], n, budget);
+			copy_block(*om, files[1], n, budget);
+			copy_block(*am, files[2], n, budget);
+		}
+	}
+};
+
+// Writes the pairs of a region scoring below a cutoff as a sparse file, see MatrixFlags::sparse. Tiles are kept
+// until their panel is done and its rows are written out in order, so memory holds one panel of entries plus the
+// row starts, which are written over the placeholder at the front of the file by close().
+class SparseOutput
+{
+	struct TileEntries
+	{
+		std::vector<SparseEntry> entries;
+		std::array<uint32_t, tile_size + 1> row_start;
+	};
+
+	std::ofstream file;
+	ScoreRegion region;
+	score_t cutoff;
+	std::vector<uint64_t> row_start{ 0 };
+	std::mutex mutex;
+	std::map<Tile, TileEntries> pending;
+
+	template<typename T>
+	void write(const T* data, size_t count)
+	{
+		file.write(reinterpret_cast<const char*>(data), count * sizeof(T));
+	}
+
+	FileHeader file_header() const
+	{
+		uint16_t flags = MatrixFlags::sparse | (region.triangle ? MatrixFlags::packed : 0);
+		return { 3, flags, sizeof(SparseEntry), region.rows, region.cols, sizeof(FileHeader) + sizeof(SparseHeader) };
+	}
+
+public:
+	SparseOutput(const std::string& path, ScoreRegion region, score_t cutoff) :
+		file(path, std::ios::binary | std::ios::trunc), region(region), cutoff(cutoff)
+	{
+		if (!file) throw std::runtime_error("can not write " + path);
+		auto header = file_header();
+		SparseHeader sparse_header{};
+		write(&header, 1);
+		write(&sparse_header, 1);
+		std::vector<uint64_t> placeholder(region.rows + 1);
+		write(placeholder.data(), placeholder.size());
+	}
+
+	void store(Tile tile, const TileScores& block)
+	{
+		size_t i0 = tile.first * tile_size, i1 = std::min(region.rows, i0 + tile_size);
+		size_t j0 = tile.second * tile_size, j1 = std::min(region.cols, j0 + tile_size);
+
+		TileEntries tile_entries;
+		tile_entries.row_start[0] = 0;
+		for (size_t i = i0; i < i1; i++)
+		{
+			size_t row = (i - i0) * tile_size;
+			auto last = region.triangle ? std::min(j1, i + 1) : j1;
+			for (size_t j = j0; j < last; j++)
+			{
+				auto k = row + j - j0;
+				// like the other outputs, the diagonal gets the mirrored alignment
+				auto alignment = region.triangle && i == j ? -block.alignment[k] : block.alignment[k];
+				if (block.score[k] < cutoff)
+					tile_entries.entries.push_back({ uint32_t(j), block.score[k], alignment, uint8_t(block.orientation[k]), {} });
+			}
+			tile_entries.row_start[i - i0 + 1] = uint32_t(tile_entries.entries.size());
+		}
+
+		std::lock_guard lock(mutex);
+		pending.emplace(tile, std::move(tile_entries));
+	}
+
+	// writes the rows of a finished panel, after all its tiles were stored
+	void write_rows(std::span<const Tile> panel)
+	{
+		for (size_t bi = panel.front().first; bi <= panel.back().first; bi++)
+		{
+			auto first = pending.lower_bound({ bi, 0 }), last = pending.lower_bound({ bi + 1, 0 });
+			for (size_t i = bi * tile_size; i < std::min(region.rows, (bi + 1) * tile_size); i++)
+			{
+				auto count = row_start.back();
+				for (auto it = first; it != last; ++it)
+				{
+					auto& tile_entries = it->second;
+					auto begin = tile_entries.row_start[i - bi * tile_size], end = tile_entries.row_start[i - bi * tile_size + 1];
+					write(tile_entries.entries.data() + begin, end - begin);
+					count += end - begin;
+				}
+				row_start.push_back(count);
+			}
+			pending.erase(first, last);
+		}
+	}
+
+	uint64_t entry_count() const
+	{
+		return row_start.back();
+	}
+
+	void close()
+	{
+		auto header = file_header();
+		SparseHeader sparse_header{ cutoff, 0, entry_count() };
+		file.seekp(0);
+		write(&header, 1);
+		write(&sparse_header, 1);
+		write(row_start.data(), row_start.size());
+		file.close();
+	}
+};
\ No newline at end of file
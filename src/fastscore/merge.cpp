@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "flags.h"
+
+#include "io.h"
+#include "shard.h"
+#include "tiles.h"
+
+#include "common/MemoryMappedMatrix.h"
+#include "common/ParallelFor.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+void print_usage_and_exit() {
+	puts(R"(
+USAGE: fastscore-merge SHARD... [OPTIONS...]
+Stitches the shards of a `fastscore --shard=K/N` run into the .bin, .orientation.bin and .align.bin outputs.
+Available options:
+    --basename=PATH                        specify output base name, by default that of the shards
+    --output-format={bin, packed, records} choose output format, see fastscore
+    --memory-budget=MB                     resident memory for the output matrices, 1024 by default
+    --threads=NUM                          number of worker threads, all hardware threads by default
+)");
+	exit(1);
+}
+
+int main(int argc, char** argv) {
+	const flags::args args(argc, argv);
+
+	auto&& positional = args.positional();
+	if (positional.empty()) print_usage_and_exit();
+
+	int memory_budget_mb = args.get<int>("memory-budget", 1024);
+	int threads = args.get<int>("threads", 0);
+	if (memory_budget_mb <= 0 || threads < 0) print_usage_and_exit();
+
+	auto output_format_str = args.get<string>("output-format", "bin");
+	OutputFormat output_format;
+	if (output_format_str == "bin") output_format = OutputFormat::binary;
+	else if (output_format_str == "packed") output_format = OutputFormat::packed;
+	else if (output_format_str == "records") output_format = OutputFormat::records;
+	else print_usage_and_exit();
+
+	ThreadPool::configure_global(threads, false);
+
+	vector<unique_ptr<ShardFile>> shard_files;
+	try {
+		for (auto& path : positional) {
+			shard_files.push_back(make_unique<ShardFile>(string(path)));
+		}
+	}
+	catch (const exception& e) {
+		cout << e.what() << "\n";
+		return 1;
+	}
+
+	auto& first = shard_files.front()->header();
+	size_t n = first.n, shards = first.shards;
+
+	// every shard of the run has to be there exactly once
+	vector<ShardFile*> by_index(shards, nullptr);
+	for (size_t k = 0; k < shard_files.size(); k++) {
+		auto& h = shard_files[k]->header();
+		if (h.n != n || h.shards != shards || h.config_hash != first.config_hash) {
+			cout << positional[k] << " belongs to a different run than " << positional[0] << "\n";
+			return 1;
+		}
+		if (h.shard >= shards || by_index[h.shard] != nullptr || h.tiles != shard_tile_count(n, h.shard, shards)) {
+			cout << positional[k] << " is a duplicate or damaged shard\n";
+			return 1;
+		}
+		by_index[h.shard] = shard_files[k].get();
+	}
+	if (shard_files.size() != shards) {
+		cout << "Expected " << shards << " shards, got " << shard_files.size() << "\n";
+		return 1;
+	}
+	if (output_format == OutputFormat::records && first.max_alignment > PairRecord::max_alignment) {
+		cout << "the records output format only holds alignments of up to " << PairRecord::max_alignment << " residues, merge into bin or packed instead\n";
+		return 1;
+	}
+
+	string default_basename(positional[0]);
+	default_basename = default_basename.substr(0, default_basename.rfind(".shard-"));
+	auto basename = args.get<string>("basename", std::move(default_basename));
+
+	cout << "Merging " << shards << " shards of " << n << " peptides into " << basename << "\n";
+
+	fs::remove(basename + ".config");
+	MappedOutputs outputs(basename, n, output_format);
+
+	// walk the tiles in row order, which visits the shards round robin and the outputs panel by panel
+	size_t row_bytes = MappedOutputs::row_bytes(n, output_format);
+	size_t panel_height = max<size_t>(1, (size_t(memory_budget_mb) << 20) / (2 * row_bytes) / tile_size);
+
+	atomic<bool> damaged = false;
+	auto tiles = all_tiles(n);
+	for (auto first = tiles.begin(); first != tiles.end();)
+	{
+		auto panel = first->first / panel_height;
+		auto last = find_if(first, tiles.end(), [&](const Tile& tile) { return tile.first / panel_height != panel; });
+		parallel_for(first, last, [&](Tile tile) {
+			auto& record = (*by_index[shard_of(tile, shards)])[position_in_shard(tile, shards)];
+			if (!record.stored || record.row != tile.first || record.col != tile.second) {
+				damaged = true;
+				return;
+			}
+			outputs.store(tile, record.scores);
+		});
+		auto [first_row, last_row] = peptide_rows({ first, last }, n);
+		outputs.finish_rows(first_row, last_row, (size_t(memory_budget_mb) << 20) / 2);
+		for (auto& shard_file : shard_files) shard_file->flush(true);
+		first = last;
+	}
+
+	if (damaged) {
+		cout << "Some shards contain tiles that were never scored, the outputs are incomplete\n";
+		return 1;
+	}
+	write_config_hash(basename, first.config_hash);
+
+	return 0;
+}
@@ -8,6 +8,7 @@
 #include <cctype>
 #include <filesystem>
 #include <iostream>
+#include <optional>
 #include <set>
 #include <string>
 #include <thread>
@@ -29,18 +30,53 @@ Available options:
     --orientation={parallel, antiparallel, both}
     --score-func={potapov, bcipa, qcipa	   choose scoring function
 				  icipa_core_vert, icipa_nter_core}
-	--output-format={bin, csv}			   choose output format
+	--output-format={bin, packed,		   choose output format, packed stores only the lower triangle,
+				  records, csv}			   records packs all outputs of a pair into BASENAME.records.bin
+    --threads=NUM                          number of worker threads, all hardware threads by default
+    --pin-threads={0, 1}                   bind worker i to the i-th CPU the process may run on, false by default;
+                                           give concurrent runs disjoint CPUs (e.g. with taskset) or they share cores
+    --stream={0, 1}                        score straight into the memory mapped .bin outputs, false by default
+    --memory-budget=MB                     resident memory for the output matrices when streaming, 1024 by default
+    --resume={0, 1}                        continue an interrupted streaming run from its checkpoint, implies --stream
+    --heptad-tables={0, 1}                 score peptides made of whole heptads from precomputed heptad tables,
+                                           potapov only, false by default
+    --precision={float, int16, int8}       store and sum the potapov weights as floats or as 16 / 8 bit integers,
+                                           which take less cache at a bounded loss of accuracy, float by default
+    --shard=K/N                            score only shard K (0 <= K < N) of N into BASENAME.shard-K-of-N,
+                                           see fastscore-merge
+    --against=LIBRARY                      score every INPUT peptide against every LIBRARY one into n x m .bin
+                                           outputs, one row per INPUT peptide, within --memory-budget
+    --extend=OLD.bin                       reuse the outputs of an earlier run with the same options whose input
+                                           is a prefix of INPUT and score only the new peptides, within
+                                           --memory-budget; OLD.bin may be OLD.records.bin, and OLD.config
+                                           has to show that they were scored with the same options
+    --extend-fasta=PATH                    the input of the earlier run, OLD.fasta by default
+    --cache=PATH                           read the pairs scored before with the same options from this cache
+                                           file and add the new ones, it can be shared by concurrent runs
+    --cache-size=MB                        size of the cache file when creating it, 1024 by default
+    --sparse-below=X                       write only the pairs scoring below X, row by row, into
+                                           BASENAME.sparse.bin instead of the other outputs; works with --against
 )");
 		exit(1);
 	}
 
-	fs::path fasta_path, current_executable_path;
-	std::string basename;
+	fs::path fasta_path, against_path, extend_fasta_path, cache_path, current_executable_path;
+	std::string basename, extend_basename;
 	std::vector<ScoringOptions::alignment_t> alignment;
 	ScoringOptions::Orientation orientation;
 	ScoringOptions::ScoreFunc score_func;
 	bool truncate;
 	OutputFormat output_format;
+	unsigned threads;
+	bool pin_threads;
+	bool stream;
+	bool resume;
+	size_t shard, shards;
+	bool heptad_tables;
+	ScoringOptions::Precision precision;
+	size_t memory_budget;
+	size_t cache_size;
+	std::optional<float> sparse_below;
 
 	void parse_alignment(const std::string& alignment_str) {
 		std::istringstream ss(alignment_str);
@@ -137,12 +173,130 @@ Available options:
 		if (output_format_str == "bin") {
 			output_format = OutputFormat::binary;
 		}
+		else if (output_format_str == "packed") {
+			output_format = OutputFormat::packed;
+		}
+		else if (output_format_str == "records") {
+			output_format = OutputFormat::records;
+			if (any_of(alignment.begin(), alignment.end(), [](auto a) { return abs(a) > PairRecord::max_alignment; })) {
+				std::cout << "the records output format only holds alignments of up to " << PairRecord::max_alignment << " residues\n";
+				exit(1);
+			}
+		}
 		else if (output_format_str == "csv") {
 			output_format = OutputFormat::csv;
 		} 
 		else {
 			print_usage_and_exit();
 		}
+
+		int threads_arg = args.get<int>("threads", 0);
+		if (threads_arg < 0) {
+			print_usage_and_exit();
+		}
+		threads = threads_arg > 0 ? threads_arg : std::max(1u, std::thread::hardware_concurrency());
+		pin_threads = args.get<bool>("pin-threads", false);
+
+		resume = args.get<bool>("resume", false);
+		stream = resume || args.get<bool>("stream", false);
+		if (stream && output_format == OutputFormat::csv) {
+			std::cout << "streaming is not supported with the csv output format\n";
+			exit(1);
+		}
+		heptad_tables = args.get<bool>("heptad-tables", false);
+		if (heptad_tables && score_func != ScoringOptions::ScoreFunc::potapov) {
+			std::cout << "heptad tables are only available for the potapov scoring function\n";
+			exit(1);
+		}
+
+		auto precision_str = args.get<string>("precision", "float");
+		if (precision_str == "float") {
+			precision = ScoringOptions::Precision::float32;
+		}
+		else if (precision_str == "int16") {
+			precision = ScoringOptions::Precision::int16;
+		}
+		else if (precision_str == "int8") {
+			precision = ScoringOptions::Precision::int8;
+		}
+		else {
+			print_usage_and_exit();
+		}
+		if (precision != ScoringOptions::Precision::float32 && score_func != ScoringOptions::ScoreFunc::potapov) {
+			std::cout << "integer precision is only available for the potapov scoring function\n";
+			exit(1);
+		}
+
+		shard = shards = 0;
+		if (auto shard_str = args.get<string>("shard")) {
+			char slash = 0;
+			std::istringstream ss(shard_str.value());
+			if (!(ss >> shard >> slash >> shards) || slash != '/' || shard >= shards) {
+				print_usage_and_exit();
+			}
+			if (stream || output_format != OutputFormat::binary) {
+				std::cout << "a shard is written in its own format, it can not be combined with --stream, --resume or --output-format\n";
+				exit(1);
+			}
+		}
+
+		if (auto against_str = args.get<string>("against")) {
+			against_path = fs::path(against_str.value());
+			if (!fs::exists(against_path)) {
+				std::cout << "The specified library path " << against_path.string() << " does not exist\n";
+				exit(1);
+			}
+			if (stream || shards > 0 || output_format != OutputFormat::binary) {
+				std::cout << "--against always writes the bin outputs, it can not be combined with --stream, --resume, --shard or --output-format\n";
+				exit(1);
+			}
+		}
+
+		if (auto extend_str = args.get<string>("extend")) {
+			extend_basename = extend_str.value();
+			for (string suffix : { ".records.bin", ".bin" }) {
+				if (extend_basename.ends_with(suffix)) {
+					extend_basename.resize(extend_basename.size() - suffix.size());
+					break;
+				}
+			}
+			extend_fasta_path = fs::path(args.get<string>("extend-fasta", extend_basename + ".fasta"));
+			if (!fs::exists(extend_fasta_path)) {
+				std::cout << "The input of the extended run " << extend_fasta_path.string() << " does not exist, see --extend-fasta\n";
+				exit(1);
+			}
+			if (stream || shards > 0 || !against_path.empty() || output_format == OutputFormat::csv) {
+				std::cout << "--extend can not be combined with --stream, --resume, --shard, --against or the csv output format\n";
+				exit(1);
+			}
+		}
+
+		sparse_below = args.get<float>("sparse-below");
+		if (sparse_below && (stream || shards > 0 || !extend_basename.empty() || output_format != OutputFormat::binary)) {
+			std::cout << "--sparse-below writes its own format, it can not be combined with --stream, --resume, --shard, --extend or --output-format\n";
+			exit(1);
+		}
+
+		int memory_budget_mb = args.get<int>("memory-budget", 1024);
+		if (memory_budget_mb <= 0) {
+			print_usage_and_exit();
+		}
+		memory_budget = size_t(memory_budget_mb) << 20;
+
+		cache_path = fs::path(args.get<string>("cache", ""));
+		int cache_size_mb = args.get<int>("cache-size", 1024);
+		if (cache_size_mb <= 0) {
+			print_usage_and_exit();
+		}
+		cache_size = size_t(cache_size_mb) << 20;
+	}
+
+	// everything that changes the scores, so that a checkpoint is only reused by an identical run
+	std::string scoring_config() const {
+		std::ostringstream ss;
+		ss << "score-func=" << int(score_func) << " orientation=" << int(orientation) << " truncate=" << truncate << " heptad-tables=" << heptad_tables << " precision=" << int(precision) << " alignment=";
+		for (auto align : alignment) ss << int(align) << ',';
+		return ss.str();
 	}
 
 	void print_parsed() {
@@ -191,6 +345,10 @@ Available options:
 			switch (output_format) {
 			case OutputFormat::binary:
 				return "binary";
+			case OutputFormat::packed:
+				return "packed binary";
+			case OutputFormat::records:
+				return "packed records";
 			case OutputFormat::csv:
 				return "csv";
 			default:
@@ -198,6 +356,38 @@ Available options:
 			}
 		}() << endl;
 
-		cout << "Running on " << std::thread::hardware_concurrency() << " threads\n";
+		if (heptad_tables) {
+			cout << "Heptad tables are used where the peptides allow it\n";
+		}
+
+		if (precision != ScoringOptions::Precision::float32) {
+			cout << "Potapov weights are quantized to " << (precision == ScoringOptions::Precision::int16 ? "int16" : "int8") << "\n";
+		}
+
+		cout << "Running on " << threads << " threads" << (pin_threads ? ", pinned" : "") << "\n";
+
+		if (shards > 0) {
+			cout << "Scoring shard " << shard << " of " << shards << "\n";
+		}
+
+		if (!against_path.empty()) {
+			cout << "Scoring against the library " << against_path.string() << " with a memory budget of " << (memory_budget >> 20) << " MB\n";
+		}
+
+		if (!extend_basename.empty()) {
+			cout << "Extending the outputs of " << extend_basename << ", the scores of " << extend_fasta_path.string() << ", with a memory budget of " << (memory_budget >> 20) << " MB\n";
+		}
+
+		if (sparse_below) {
+			cout << "Only the pairs scoring below " << *sparse_below << " are written\n";
+		}
+
+		if (!cache_path.empty()) {
+			cout << "Pair scores are cached in " << cache_path.string() << "\n";
+		}
+
+		if (stream) {
+			cout << "Streaming the outputs with a memory budget of " << (memory_budget >> 20) << " MB\n";
+		}
 	}
 };
\ No newline at end of file
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "MemoryMapped.h"
+
+#include "tiles.h"
+
+// A shard holds the tiles scored by one `fastscore --shard=K/N` run, which fastscore-merge stitches back together.
+// Tile t of the all_tiles order belongs to shard t % N at position t / N, so every shard gets an even mix of
+// long and short rows and about the same amount of work.
+
+struct ShardHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t tile_size;
+	uint64_t n;
+	uint64_t shard, shards;
+	uint64_t tiles;
+	// hash of the scoring options and the input, so that only shards of the same run are merged
+	uint64_t config_hash;
+	// the largest alignment, in residues either way, the run scores; merging into records needs it to fit them
+	uint64_t max_alignment;
+};
+
+struct ShardTile
+{
+	// 0 until the tile is stored, which is what every tile of a newly created shard file reads as, so that merging
+	// never takes an unfinished shard for a finished one and no tile has to be written before it is scored
+	uint64_t stored;
+	uint64_t row, col;
+	TileScores scores;
+};
+
+inline uint64_t fnv1a(std::string_view data, uint64_t hash = 14695981039346656037ull)
+{
+	for (unsigned char c : data)
+	{
+		hash = (hash ^ c) * 1099511628211ull;
+	}
+	return hash;
+}
+
+inline size_t shard_of(Tile tile, size_t shards)
+{
+	return tile_index(tile) % shards;
+}
+
+inline size_t position_in_shard(Tile tile, size_t shards)
+{
+	return tile_index(tile) / shards;
+}
+
+inline size_t shard_tile_count(size_t n, size_t shard, size_t shards)
+{
+	size_t total = tile_index({ tile_rows(n), 0 });
+	return total / shards + (shard < total % shards ? 1 : 0);
+}
+
+inline std::string shard_path(const std::string& basename, size_t shard, size_t shards)
+{
+	return basename + ".shard-" + std::to_string(shard) + "-of-" + std::to_string(shards);
+}
+
+class ShardFile
+{
+	MemoryMapped file;
+
+	static constexpr char magic[8] = "FSSHARD";
+	static constexpr uint32_t version = 4;
+
+public:
+	// creates the shard file for `shard` out of `shards`, sized for all of its tiles, which all read as not stored
+	ShardFile(const std::string& path, size_t n, size_t shard, size_t shards, uint64_t config_hash, size_t max_alignment)
+	{
+		size_t tiles = shard_tile_count(n, shard, shards);
+		if (!file.open(path, sizeof(ShardHeader) + tiles * sizeof(ShardTile)))
+			throw std::runtime_error("can not create shard file " + path);
+
+		auto& h = header();
+		memcpy(h.magic, magic, sizeof(magic));
+		h.version = version;
+		h.tile_size = tile_size;
+		h.n = n;
+		h.shard = shard;
+		h.shards = shards;
+		h.tiles = tiles;
+		h.config_hash = config_hash;
+		h.max_alignment = max_alignment;
+	}
+
+	// opens an existing shard file; MemoryMapped would create a missing one
+	explicit ShardFile(const std::string& path)
+	{
+		if (!std::filesystem::is_regular_file(path))
+			throw std::runtime_error("no shard file " + path);
+		if (!file.open(path, MemoryMapped::WholeFile) || file.size() < sizeof(ShardHeader))
+			throw std::runtime_error("can not open shard file " + path);
+
+		auto& h = header();
+		if (memcmp(h.magic, magic, sizeof(magic)) != 0 || h.version != version || h.tile_size != tile_size)
+			throw std::runtime_error(path + " is not a shard written by this version of fastscore");
+		if (file.size() != sizeof(ShardHeader) + h.tiles * sizeof(ShardTile))
+			throw std::runtime_error(path + " is truncated");
+	}
+
+	ShardHeader& header()
+	{
+		return *reinterpret_cast<ShardHeader*>(file.getData());
+	}
+
+	ShardTile& operator[](size_t position)
+	{
+		return reinterpret_cast<ShardTile*>(file.getData() + sizeof(ShardHeader))[position];
+	}
+
+	void flush(bool release = false)
+	{
+		file.flush(0, file.mappedSize(), release);
+	}
+};
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "common/SpecialMatrices.h"
+#include "scoring/ScoringHelper.h"
+
+// side of the square blocks fastscore works on; a tile of scores and the encodings of its peptides stay in L2
+constexpr size_t tile_size = 64;
+
+// (row, column) of a tile; in the lower triangle of the interaction matrix, column <= row
+using Tile = std::pair<size_t, size_t>;
+
+inline size_t tile_rows(size_t n)
+{
+	return (n + tile_size - 1) / tile_size;
+}
+
+inline size_t tile_index(Tile tile)
+{
+	return tile.first * (tile.first + 1) / 2 + tile.second;
+}
+
+// the peptides [first, last) of the tile rows from the first to the last tile of a run, among n
+inline std::pair<size_t, size_t> peptide_rows(std::span<const Tile> tiles, size_t n)
+{
+	return { tiles.front().first * tile_size, std::min(n, (tiles.back().first + 1) * tile_size) };
+}
+
+// all tiles covering n peptides, row by row
+inline std::vector<Tile> all_tiles(size_t n)
+{
+	size_t rows = tile_rows(n);
+	std::vector<Tile> tiles;
+	tiles.reserve(rows * (rows + 1) / 2);
+	for (size_t bi = 0; bi < rows; bi++)
+	{
+		for (size_t bj = 0; bj <= bi; bj++)
+		{
+			tiles.emplace_back(bi, bj);
+		}
+	}
+	return tiles;
+}
+
+// all tiles of a rows x cols rectangle, row by row
+inline std::vector<Tile> rect_tiles(size_t rows, size_t cols)
+{
+	std::vector<Tile> tiles;
+	tiles.reserve(tile_rows(rows) * tile_rows(cols));
+	for (size_t bi = 0; bi < tile_rows(rows); bi++)
+	{
+		for (size_t bj = 0; bj < tile_rows(cols); bj++)
+		{
+			tiles.emplace_back(bi, bj);
+		}
+	}
+	return tiles;
+}
+
+// The pairs a run scores: peptides [0, rows) of the set against peptides [col0, col0 + cols), tile coordinates
+// counting from (0, col0). A lower triangle keeps only the pairs with column <= row.
+struct ScoreRegion
+{
+	size_t rows, col0, cols;
+	bool triangle;
+
+	static ScoreRegion lower_triangle(size_t n)
+	{
+		return { n, 0, n, true };
+	}
+
+	// the first rows peptides of the set against the cols ones appended after them
+	static ScoreRegion rectangle(size_t rows, size_t cols)
+	{
+		return { rows, rows, cols, false };
+	}
+};
+
+// scores of one tile, row major with a stride of tile_size; on the diagonal only the lower triangle is filled
+struct TileScores
+{
+	score_t score[tile_size * tile_size];
+	ScoringOptions::Orientation orientation[tile_size * tile_size];
+	ScoringOptions::alignment_t alignment[tile_size * tile_size];
+};
+
+// Writes a tile of an n x n matrix together with its transpose, which packed matrices do not store.
+// Both the rows of the tile and of the mirrored block are written as contiguous runs.
+template<typename IM, typename OM, typename AM>
+void store_tile(size_t n, Tile tile, const TileScores& block, IM& im, OM& om, AM& am, bool mirror = true)
+{
+	size_t i0 = tile.first * tile_size, i1 = std::min(n, i0 + tile_size);
+	size_t j0 = tile.second * tile_size, j1 = std::min(n, j0 + tile_size);
+
+	for (size_t i = i0; i < i1; i++)
+	{
+		size_t row = (i - i0) * tile_size;
+		for (size_t j = j0; j < std::min(j1, i + 1); j++)
+		{
+			im[i][j] = block.score[row + j - j0];
+			om[i][j] = block.orientation[row + j - j0];
+			am[i][j] = block.alignment[row + j - j0];
+		}
+	}
+
+	if (!mirror)
+	{
+		// the diagonal is still the last write of the mirrored block above
+		for (size_t i = std::max(i0, j0); i < std::min(i1, j1); i++)
+		{
+			am[i][i] = -block.alignment[(i - i0) * tile_size + (i - j0)];
+		}
+		return;
+	}
+
+	for (size_t j = j0; j < j1; j++)
+	{
+		for (size_t i = std::max(i0, j); i < i1; i++)
+		{
+			size_t k = (i - i0) * tile_size + (j - j0);
+			im[j][i] = block.score[k];
+			om[j][i] = block.orientation[k];
+			am[j][i] = -block.alignment[k];
+		}
+	}
+}
+
+// Writes a tile into a packed matrix of PairRecords; like above, the diagonal gets the mirrored alignment.
+template<typename RM>
+void store_tile_records(size_t n, Tile tile, const TileScores& block, RM& records)
+{
+	size_t i0 = tile.first * tile_size, i1 = std::min(n, i0 + tile_size);
+	size_t j0 = tile.second * tile_size, j1 = std::min(n, j0 + tile_size);
+
+	for (size_t i = i0; i < i1; i++)
+	{
+		size_t row = (i - i0) * tile_size;
+		for (size_t j = j0; j < std::min(j1, i + 1); j++)
+		{
+			auto alignment = block.alignment[row + j - j0];
+			records[i][j] = PairRecord::make(block.score[row + j - j0], uint8_t(block.orientation[row + j - j0]), i == j ? -alignment : alignment);
+		}
+	}
+}
+
+
+// Writes a tile of an n x m rectangle, which has no transpose to mirror.
+template<typename IM, typename OM, typename AM>
+void store_rect_tile(size_t n, size_t m, Tile tile, const TileScores& block, IM& im, OM& om, AM& am)
+{
+	size_t i0 = tile.first * tile_size, i1 = std::min(n, i0 + tile_size);
+	size_t j0 = tile.second * tile_size, j1 = std::min(m, j0 + tile_size);
+
+	for (size_t i = i0; i < i1; i++)
+	{
+		size_t row = (i - i0) * tile_size;
+		std::copy(block.score + row, block.score + row + (j1 - j0), im[i] + j0);
+		std::copy(block.orientation + row, block.orientation + row + (j1 - j0), om[i] + j0);
+		std::copy(block.alignment + row, block.alignment + row + (j1 - j0), am[i] + j0);
+	}
+}
\ No newline at end of file
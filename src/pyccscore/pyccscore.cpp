@@ -15,6 +15,7 @@
 #include "scoring/ScoringEngineQCIPA.h"
 #include "scoring/ScoringEngineICIPA.h"
 #include "scoring/ScoringEnginePotapov.h"
+#include "scoring/PotapovQueryScorer.h"
 
 namespace py = pybind11;
 namespace fs = std::filesystem;
@@ -61,4 +62,39 @@ PYBIND11_MODULE(pyccscore, m)
 	register_scoring_engine(m, qcipa, "score_qcipa");
 	register_scoring_engine(m, icipa_core_vert, "icipa_core_vert");
 	register_scoring_engine(m, icipa_nter_core, "icipa_nter_core");
+
+	using namespace py::literals;
+	using namespace ScoringOptions;
+
+	py::class_<PotapovQueryScorer>(m, "PotapovQuery", "One chain compiled for scoring against many others with the Potapov function")
+		.def(py::init([potapov](std::string_view query) { return PotapovQueryScorer(*potapov, query); }), "query"_a)
+		.def("score", [](PotapovQueryScorer& query,
+			std::string_view chain2,
+			std::vector<alignment_t> alignment,
+			bool truncate,
+			Orientation orientation) {
+				auto ret = query.score(chain2, alignment, truncate, orientation);
+				return std::make_tuple(ret.score, ret.alignment, ret.orientation);
+			},
+			"chain2"_a,
+			py::arg_v("alignment", std::vector<alignment_t>{0}, "[0]"),
+			"truncate"_a = false,
+			py::arg_v("orientation", Orientation::parallel))
+		.def("score_many", [](PotapovQueryScorer& query,
+			std::vector<std::string> chains2,
+			std::vector<alignment_t> alignment,
+			bool truncate,
+			Orientation orientation) {
+				std::vector<std::tuple<float, alignment_t, Orientation>> ret;
+				ret.reserve(chains2.size());
+				for (auto& chain2 : chains2) {
+					auto score = query.score(chain2, alignment, truncate, orientation);
+					ret.emplace_back(score.score, score.alignment, score.orientation);
+				}
+				return ret;
+			},
+			"chains2"_a,
+			py::arg_v("alignment", std::vector<alignment_t>{0}, "[0]"),
+			"truncate"_a = false,
+			py::arg_v("orientation", Orientation::parallel));
 }
\ No newline at end of file
@@ -2,6 +2,13 @@
 
 #include "ScoringHelper.h"
 
+#include <algorithm>
+#include <array>
+#include <iterator>
+#include <span>
+#include <string_view>
+#include <vector>
+
 struct CIPAScores
 {
 	float avg_hp_sum;
@@ -18,17 +25,34 @@ template <
 struct CIPAHelper
 {
 	using string_view = std::string_view;
+	using window_t = ScoringOptions::window_t;
+
+	// chains are scored as residue codes, gaps ('-') and positions past the end of a chain taking gap_code
+	const static uint8_t gap_code = detail::gap_code;
+	const static int padded_alphabet_size = 21;
 
-	using weights_t = std::array<float, 20 * 20>;
+	// pair weights indexed by pair_index, every pair with a gap weighing 0
+	using weights_t = std::array<float, padded_alphabet_size * padded_alphabet_size>;
 	weights_t c_scores, es_scores, cv_scores, nterm_c_scores;
 
+	// helical propensity and charge of every residue code, gaps having neither
+	std::array<float, padded_alphabet_size> hp_scores;
+	std::array<int, padded_alphabet_size> charges;
+
+	const uint8_t leucine = detail::residue_code('L');
+
+	static size_t pair_index(uint8_t code1, uint8_t code2)
+	{
+		return code1 * padded_alphabet_size + code2;
+	}
+
 	template <typename Iterable>
 	void insert_weights(const Iterable weights_to_insert, weights_t &weights)
 	{
 		weights.fill(0);
 		for (const auto p : weights_to_insert)
 		{
-			weights[detail::residues_hash<2>(p.first)] = p.second;
+			weights[pair_index(detail::residue_code(p.first[0]), detail::residue_code(p.first[1]))] = p.second;
 		}
 	}
 
@@ -53,138 +77,116 @@ struct CIPAHelper
 		insert_weights(weights_to_insert, nterm_c_scores);
 	}
 
+	void init_residue_scores()
+	{
+		//indexed by residue code, following the alphabet ACDEFGHIKLMNPQRSTVWY
+		const float hp[] = {1.41f, 0.66f, 0.99f, 1.59f, 1.16f, 0.43f, 1.05f, 1.09f, 1.23f, 1.34f, 1.30f, 0.76f, 0.34f, 1.27f, 1.21f, 0.57f, 0.76f, 0.98f, 1.02f, 0.74f};
+		std::copy(std::begin(hp), std::end(hp), hp_scores.begin());
+		hp_scores[gap_code] = 0;
+
+		charges.fill(0);
+		for (const char c : string_view("ACDEFGHIKLMNPQRSTVWY"))
+		{
+			charges[detail::residue_code(c)] = residue_charge(c);
+		}
+	}
+
 	CIPAHelper()
 	{
 		init_c_weights();
 		init_es_weights();
 		init_cv_weights();
 		init_nterm_c_weights();
+		init_residue_scores();
 	}
 
-	float generic_pair_score(const char c1, const char c2, weights_t &weights)
-	{
-		if (!isupper(c1) || !isupper(c2)) return 0;
-
-		char buf[2];
-		buf[0] = c1;
-		buf[1] = c2;
-
-		return weights[detail::residues_hash<2>({buf, 2})];
-	}
-
-	float hp_score(const char c)
-	{
-		if (!isupper(c))
-			return 0;
-		const float scores[] = {1.41f, 0.66f, 0.99f, 1.59f, 1.16f, 0.43f, 1.05f, 1.09f, 1.23f, 1.34f, 1.30f, 0.76f, 0.34f, 1.27f, 1.21f, 0.57f, 0.76f, 0.98f, 1.02f, 0.74f};
-		return scores[detail::residue_code(c)];
-	}
-	float c_score(const char c1, const char c2)
-	{
-		return generic_pair_score(c1, c2, c_scores);
-	}
-	float es_score(const char c1, const char c2)
-	{
-		return generic_pair_score(c1, c2, es_scores);
-	}
-	float cv_score(const char c1, const char c2)
-	{
-		return generic_pair_score(c1, c2, cv_scores);
-	}
-	float nterm_c_score(const char c1, const char c2)
-	{
-		return generic_pair_score(c1, c2, nterm_c_scores);
-	}
-	constexpr int residue_charge(const char c)
+	constexpr static int residue_charge(const char c)
 	{
 		const int charges[] = {0, 0, 0, -1, -1, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0};
 		return charges[c - 'A'];
 	}
 
-	int charge_sum(string_view chain)
+	int charge_sum(const uint8_t* codes, size_t n) const
 	{
 		int charge = 0;
-		for (const char c : chain)
+		for (size_t i = 0; i < n; i++)
 		{
-			if (!isupper(c))
-				continue;
-			charge += residue_charge(c);
+			charge += charges[codes[i]];
 		}
 		return charge;
 	}
 
-	float score(string_view chain1, string_view chain2)
+	// Scores the first n positions of two encoded chains, the register of position i being i % 7 (0 = f), given the
+	// net charges of those positions. Every term walks its registers heptad by heptad, positions missing a residue in
+	// either chain adding 0, so no branch depends on the residues. The terms are summed in the order of the positions
+	// all the same, which keeps the scores bit-identical to scoring the chains residue by residue.
+	float score(const uint8_t* codes1, const uint8_t* codes2, size_t n, int charge_sum1, int charge_sum2) const
 	{
-		auto n1 = chain1.length();
-		auto n2 = chain2.length();
-
-		auto n = std::min(n1, n2);
-
-		int n_pairs = 0;
-		float hp_sum = 0.f, es_sum = 0.f, c_sum = 0.f, cv_sum = 0.f, nterm_c = 0.f;
-		int num_LL_on_d = 0;
-		int charge_sum1 = 0, charge_sum2 = 0;
-		for (int i = 0; i < n; i++)
 		//fgabcde register
 		//0123456
-		{
-			int reg = i % 7; //register index (0 = f)
-
-			if (!isupper(chain1[i]) || !isupper(chain2[i]))
-				continue;
+		auto paired = [&](size_t i) { return codes1[i] != gap_code && codes2[i] != gap_code; };
 
-			/* helical propensity contribution */
-			if ((hp_score(chain1[i])) != 0 && (hp_score(chain2[i]) != 0)) //only count paired residues ('-':'X' pairs contribute nothing)
-			{
-				hp_sum += hp_score(chain1[i]) + hp_score(chain2[i]);
-				n_pairs++;
-			}
-
-			/* core contribution */
-			if (CIPAImpl::core_position_filter(reg))
-			{
-				c_sum += c_score(chain1[i], chain2[i]);
-			}
+		/* helical propensity contribution, over the paired positions */
+		int n_pairs = 0;
+		float hp_sum = 0.f;
+		for (size_t i = 0; i < n; i++)
+		{
+			bool p = paired(i);
+			hp_sum += p ? hp_scores[codes1[i]] + hp_scores[codes2[i]] : 0.f;
+			n_pairs += p;
+		}
 
-			/* electrostatic contribution */
-			else if (reg == 1) //g sites - interact with next e on opposite chain
+		/* core contribution */
+		float c_sum = 0.f;
+		for (size_t h = 0; h < n; h += 7)
+		{
+			for (size_t reg = 0; reg < 7; reg++)
 			{
-				if (i + 5 < n2)
+				if (CIPAImpl::core_position_filter(int(reg)) && h + reg < n)
 				{
-					if (!isupper(chain2[i + 5]))
-						continue;
-					es_sum += es_score(chain1[i], chain2[i + 5]);
-				}
-				if (i + 5 < n1)
-				{
-					if (!isupper(chain1[i + 5]))
-						continue;
-					es_sum += es_score(chain2[i], chain1[i + 5]);
+					c_sum += c_scores[pair_index(codes1[h + reg], codes2[h + reg])];
 				}
 			}
+		}
 
-			/* LL pairs on the dd' positions */
-			if (reg == 5)
+		/* electrostatic contribution: g sites interact with the next e on the opposite chain */
+		float es_sum = 0.f;
+		if constexpr (!CIPAImpl::core_position_filter(1))
+		{
+			for (size_t i = 1; i + 5 < n; i += 7)
 			{
-				if (chain1[i] == 'L' && chain2[i] == 'L')
-					num_LL_on_d++;
+				bool p = paired(i);
+				es_sum += p ? es_scores[pair_index(codes1[i], codes2[i + 5])] : 0.f;
+				//a gap opposite the first e also drops the second pair
+				es_sum += p && codes2[i + 5] != gap_code ? es_scores[pair_index(codes2[i], codes1[i + 5])] : 0.f;
 			}
+		}
 
-			/* a-a+1 pairs vertically along a single peptide */
-			if (reg == 2)
+		/* LL pairs on the dd' positions */
+		int num_LL_on_d = 0;
+		for (size_t i = 5; i < n; i += 7)
+		{
+			num_LL_on_d += (codes1[i] == leucine) & (codes2[i] == leucine);
+		}
+
+		/* a-a+1 pairs vertically along a single peptide */
+		float cv_sum = 0.f;
+		if constexpr (!CIPAImpl::cv_weights.empty())
+		{
+			for (size_t i = 2; i + 7 < n; i += 7)
 			{
-				if (i + 7 < n)
-				{
-					cv_sum += cv_score(chain1[i], chain1[i + 7]);
-					cv_sum += cv_score(chain2[i], chain2[i + 7]);
-				}
+				bool p = paired(i);
+				cv_sum += p ? cv_scores[pair_index(codes1[i], codes1[i + 7])] : 0.f;
+				cv_sum += p ? cv_scores[pair_index(codes2[i], codes2[i + 7])] : 0.f;
 			}
 		}
 
-		charge_sum1 = charge_sum(chain1);
-		charge_sum2 = charge_sum(chain2);
-
-		nterm_c = nterm_c_score(chain1[2], chain2[2]);
+		//truncation can leave windows too short to hold the third position
+		float nterm_c = 0.f;
+		if constexpr (!CIPAImpl::nterm_c_weights.empty())
+		{
+			nterm_c = n > 2 ? nterm_c_scores[pair_index(codes1[2], codes2[2])] : 0.f;
+		}
 
 		CIPAScores scores;
 		scores.avg_hp_sum = hp_sum / n_pairs;
@@ -198,4 +200,52 @@ struct CIPAHelper
 		auto ret = -CIPAImpl::calculate_score(scores);
 		return ret;
 	}
+
+	// scores two chains of letters, the shorter one being padded with gaps
+	float score(string_view chain1, string_view chain2) const
+	{
+		static thread_local std::vector<uint8_t> codes1, codes2;
+
+		auto n = std::max(chain1.length(), chain2.length());
+		auto encode = [n](string_view chain, std::vector<uint8_t>& codes) {
+			codes.assign(n, gap_code);
+			std::transform(chain.begin(), chain.end(), codes.begin(), [](char r) { return detail::encode_residue(r); });
+		};
+		encode(chain1, codes1);
+		encode(chain2, codes2);
+
+		return score(codes1.data(), codes2.data(), n, charge_sum(codes1.data(), n), charge_sum(codes2.data(), n));
+	}
+
+	// scores one pair of padded chains at every displacement at once, window w starting at windows[w] and being
+	// lengths[w] long; the net charge of every window comes from charge prefix sums over the chains, taken just once
+	void score_displacements(const uint8_t* codes1, const uint8_t* codes2, std::span<const window_t> windows, const size_t* lengths, float* out) const
+	{
+		static thread_local std::vector<int> charge_prefix1, charge_prefix2;
+
+		size_t end1 = 0, end2 = 0;
+		for (size_t w = 0; w < windows.size(); w++)
+		{
+			end1 = std::max(end1, windows[w].start1 + lengths[w]);
+			end2 = std::max(end2, windows[w].start2 + lengths[w]);
+		}
+
+		auto prefix_sums = [this](const uint8_t* codes, size_t end, std::vector<int>& prefix) {
+			prefix.resize(end + 1);
+			prefix[0] = 0;
+			for (size_t i = 0; i < end; i++)
+			{
+				prefix[i + 1] = prefix[i] + charges[codes[i]];
+			}
+		};
+		prefix_sums(codes1, end1, charge_prefix1);
+		prefix_sums(codes2, end2, charge_prefix2);
+
+		for (size_t w = 0; w < windows.size(); w++)
+		{
+			auto [start1, start2] = windows[w];
+			auto n = lengths[w];
+			out[w] = score(codes1 + start1, codes2 + start2, n, charge_prefix1[start1 + n] - charge_prefix1[start1], charge_prefix2[start2 + n] - charge_prefix2[start2]);
+		}
+	}
 };
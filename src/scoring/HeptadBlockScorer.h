@@ -0,0 +1,200 @@
+#pragma once
+
+#include <array>
+#include <map>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "ScoringEnginePotapov.h"
+#include "ScoringHelper.h"
+
+#include "common/ParallelFor.h"
+#include "common/PeptideSet.h"
+
+// Scores peptide sets built from whole heptads, like the combinatorial libraries of util/01_generate.py, with table
+// lookups instead of the Potapov tuples. Every peptide is cut into heptads, and the contribution of each pair of
+// heptads facing each other, and of each junction between two such pairs, is computed once up front. An aligned pair
+// of chains then costs one intra and one junction lookup per heptad. The alignments, truncation and orientations
+// are applied heptad by heptad exactly as ScoringHelper applies them residue by residue; only the order in which
+// the weights are summed differs, so scores can differ from ScoringHelper's in the last bits.
+class HeptadBlockScorer
+{
+	using alignment_t = ScoringOptions::alignment_t;
+	using aligned_score_t = ScoringOptions::aligned_score_t;
+	using aligned_oriented_score_t = ScoringOptions::aligned_oriented_score_t;
+	using Orientation = ScoringOptions::Orientation;
+
+	// heptad 0 is all gaps, standing for the padding around the chains
+	const static uint16_t gap_heptad = 0;
+	// junction tables grow with the fourth power of the number of distinct heptads
+	const static size_t max_heptads = 64;
+
+	std::vector<std::array<uint8_t, 7>> heptads;
+	// whether the first / last residue of a heptad is a gap, which is what truncation looks at
+	std::vector<char> gap_first, gap_last;
+	// per peptide, its heptads and those of its reversed sequence
+	std::vector<std::vector<uint16_t>> forward, reversed;
+
+	std::vector<float> intra, junction;
+	std::vector<int> heptad_shifts;
+	bool truncate = false;
+
+	HeptadBlockScorer() {}
+
+	uint16_t heptad_id(std::span<const uint8_t> codes, std::map<std::array<uint8_t, 7>, uint16_t>& ids)
+	{
+		std::array<uint8_t, 7> heptad;
+		std::copy(codes.begin(), codes.end(), heptad.begin());
+		auto [it, inserted] = ids.try_emplace(heptad, uint16_t(heptads.size()));
+		if (inserted) heptads.push_back(heptad);
+		return it->second;
+	}
+
+	void build_tables(const ScoringEnginePotapov& sc)
+	{
+		const size_t max_length = ScoringEnginePotapov::max_peptide_length;
+		size_t h = heptads.size();
+
+		auto fill = [&](uint8_t* codes, size_t offset, uint16_t heptad) {
+			std::copy(heptads[heptad].begin(), heptads[heptad].end(), codes + offset);
+		};
+
+		intra.resize(h * h);
+		junction.resize(h * h * h * h);
+
+		std::vector<uint16_t> first_heptads(h);
+		std::iota(first_heptads.begin(), first_heptads.end(), uint16_t(0));
+		parallel_for(first_heptads.begin(), first_heptads.end(), [&](uint16_t a0) {
+			uint8_t codes[2 * max_length];
+			std::fill(codes, codes + 2 * max_length, ScoringEnginePotapov::gap_code);
+
+			fill(codes, 0, a0);
+			for (uint16_t b0 = 0; b0 < h; b0++) {
+				fill(codes, max_length, b0);
+				intra[a0 * h + b0] = sc.heptad_score(codes, false);
+			}
+
+			for (uint16_t a1 = 0; a1 < h; a1++) {
+				fill(codes, 7, a1);
+				for (uint16_t b0 = 0; b0 < h; b0++) {
+					fill(codes, max_length, b0);
+					for (uint16_t b1 = 0; b1 < h; b1++) {
+						fill(codes, max_length + 7, b1);
+						junction[((a0 * h + a1) * h + b0) * h + b1] = sc.heptad_score(codes, true);
+					}
+				}
+			}
+		});
+	}
+
+	// heptad c of a chain after padding it to padded_length heptads and removing shift heptads from the front
+	static uint16_t padded_heptad(const std::vector<uint16_t>& chain, size_t c, size_t shift)
+	{
+		size_t idx = c + shift;
+		return idx == 0 || idx > chain.size() ? gap_heptad : chain[idx - 1];
+	}
+
+	aligned_score_t score_oriented(const std::vector<uint16_t>& chain1, const std::vector<uint16_t>& chain2) const
+	{
+		size_t h = heptads.size();
+		// as in ScoringHelper::score, both chains get one heptad of gaps on each side
+		size_t padded_length = std::max(chain1.size(), chain2.size()) + 2;
+
+		aligned_score_t best_score{ std::numeric_limits<float>::infinity(), 0 };
+
+		for (int k : heptad_shifts) {
+			if (size_t(std::abs(k)) >= padded_length) continue;
+
+			size_t shift1 = std::max(k, 0), shift2 = std::max(-k, 0);
+			size_t length = padded_length - std::abs(k);
+
+			auto at1 = [&](size_t c) { return padded_heptad(chain1, c, shift1); };
+			auto at2 = [&](size_t c) { return padded_heptad(chain2, c, shift2); };
+
+			size_t first = 0, last = length;
+			if (truncate) {
+				while (first < length && (gap_last[at1(first)] || gap_last[at2(first)])) first++;
+				while (last > first && (gap_first[at1(last - 1)] || gap_first[at2(last - 1)])) last--;
+			}
+
+			float res = 0;
+			for (size_t c = first; c < last; c++) {
+				res += intra[at1(c) * h + at2(c)];
+				if (c + 1 < last) res += junction[((at1(c) * h + at1(c + 1)) * h + at2(c)) * h + at2(c + 1)];
+			}
+
+			aligned_score_t current_score = { ScoringEnginePotapov::w0 + res, alignment_t(7 * k) };
+			if (current_score < best_score) best_score = current_score;
+		}
+
+		return best_score;
+	}
+
+public:
+	// nullopt unless every peptide and alignment is made of whole heptads and the tables stay small
+	static std::optional<HeptadBlockScorer> build(const ScoringEnginePotapov& sc, const PeptideSet& ps, const std::vector<alignment_t>& alignment, bool truncate)
+	{
+		const size_t max_length = ScoringEnginePotapov::max_peptide_length;
+		const size_t padding = 2 * ScoringHelper<ScoringEnginePotapov>::max_displacement;
+
+		HeptadBlockScorer scorer;
+		scorer.truncate = truncate;
+
+		for (auto displacement : alignment) {
+			if (displacement % 7 != 0) return std::nullopt;
+			scorer.heptad_shifts.push_back(displacement / 7);
+		}
+
+		std::map<std::array<uint8_t, 7>, uint16_t> ids;
+		std::array<uint8_t, 7> gaps;
+		gaps.fill(ScoringEnginePotapov::gap_code);
+		scorer.heptad_id(gaps, ids);
+
+		scorer.forward.resize(ps.size());
+		scorer.reversed.resize(ps.size());
+		for (size_t i = 0; i < ps.size(); i++) {
+			auto length = ps[i].sequence.length();
+			if (length % 7 != 0 || length + padding > max_length) return std::nullopt;
+
+			// the padded arena holds max_displacement gaps in front of each chain
+			auto codes = ps.encoded(i).subspan(ScoringHelper<ScoringEnginePotapov>::max_displacement, length);
+			auto reversed_codes = ps.encoded(i, true).subspan(ScoringHelper<ScoringEnginePotapov>::max_displacement, length);
+			for (size_t b = 0; b < length; b += 7) {
+				scorer.forward[i].push_back(scorer.heptad_id(codes.subspan(b, 7), ids));
+				scorer.reversed[i].push_back(scorer.heptad_id(reversed_codes.subspan(b, 7), ids));
+				if (scorer.heptads.size() > max_heptads) return std::nullopt;
+			}
+		}
+
+		for (auto& heptad : scorer.heptads) {
+			scorer.gap_first.push_back(heptad[0] == ScoringEnginePotapov::gap_code);
+			scorer.gap_last.push_back(heptad[6] == ScoringEnginePotapov::gap_code);
+		}
+
+		scorer.build_tables(sc);
+		return scorer;
+	}
+
+	size_t heptad_count() const
+	{
+		return heptads.size();
+	}
+
+	// same as ScoringHelper::score for peptides i and j of the set the tables were built for
+	aligned_oriented_score_t score(size_t i, size_t j, Orientation orientation) const
+	{
+		aligned_oriented_score_t parallel_score, antiparallel_score;
+
+		if (orientation == Orientation::antiparallel || orientation == Orientation::both) {
+			antiparallel_score = { score_oriented(forward[i], reversed[j]), Orientation::antiparallel };
+		}
+
+		if (orientation == Orientation::parallel || orientation == Orientation::both) {
+			parallel_score = { score_oriented(forward[i], forward[j]), Orientation::parallel };
+		}
+
+		return antiparallel_score.score < parallel_score.score ? antiparallel_score : parallel_score;
+	}
+};
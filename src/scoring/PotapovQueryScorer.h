@@ -0,0 +1,94 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "ScoringEnginePotapov.h"
+#include "ScoringHelper.h"
+
+// Scores one query chain against many others, like ScoringHelper::score with the query as the first chain. Each
+// window of the query that the alignments and truncation pick is compiled into a ScoringEnginePotapov::Profile the
+// first time it comes up, so that every further chain costs a lookup per position instead of a gather per tuple.
+// Chains of similar lengths share their windows; scores can differ from ScoringHelper's in the last bits.
+class PotapovQueryScorer
+{
+	using alignment_t = ScoringOptions::alignment_t;
+	using aligned_score_t = ScoringOptions::aligned_score_t;
+	using aligned_oriented_score_t = ScoringOptions::aligned_oriented_score_t;
+	using Orientation = ScoringOptions::Orientation;
+
+	ScoringHelper<ScoringEnginePotapov>& helper;
+
+	// the query padded as ScoringHelper pads it, followed by as many gaps as the longest chain scored so far needs
+	std::vector<uint8_t> query_codes;
+	size_t query_length;
+
+	// by start and length of the window of the query
+	std::map<std::pair<size_t, size_t>, ScoringEnginePotapov::Profile> profiles;
+
+	std::vector<uint8_t> codes2;
+
+	aligned_score_t score_oriented(std::span<const uint8_t> padded1, std::span<const uint8_t> padded2, const std::vector<alignment_t>& alignment, bool truncate)
+	{
+		aligned_score_t best_score{ std::numeric_limits<float>::infinity(), 0 };
+
+		for (auto displacement : alignment) {
+			auto [aligned_chain1, aligned_chain2] = helper.align_truncate(padded1, padded2, displacement, truncate);
+
+			auto [it, inserted] = profiles.try_emplace({ size_t(aligned_chain1.data() - padded1.data()), aligned_chain1.size() });
+			if (inserted) helper.sc.profile(aligned_chain1.data(), aligned_chain1.size(), it->second);
+
+			aligned_score_t current_score = { helper.sc.score(it->second, aligned_chain2.data()), displacement };
+			if (current_score < best_score) best_score = current_score;
+		}
+
+		return best_score;
+	}
+
+public:
+	PotapovQueryScorer(ScoringHelper<ScoringEnginePotapov>& helper, std::string_view query) : helper(helper), query_length(query.length())
+	{
+		const size_t max_displacement = ScoringHelper<ScoringEnginePotapov>::max_displacement;
+
+		query_codes.assign(query.length() + 2 * max_displacement, detail::gap_code);
+		std::transform(query.begin(), query.end(), query_codes.begin() + max_displacement, [](char r) { return detail::encode_residue(r); });
+	}
+
+	aligned_oriented_score_t score(std::string_view chain2, const std::vector<alignment_t>& alignment, bool truncate, Orientation orientation)
+	{
+		const size_t max_displacement = ScoringHelper<ScoringEnginePotapov>::max_displacement;
+		auto buffer_size = std::max(query_length, chain2.length()) + 2 * max_displacement;
+
+		if (query_codes.size() < buffer_size) query_codes.resize(buffer_size, detail::gap_code);
+		const std::span<const uint8_t> padded1 = std::span<const uint8_t>(query_codes).first(buffer_size);
+
+		auto pad = [&](auto begin, auto end) {
+			codes2.assign(buffer_size, detail::gap_code);
+			std::transform(begin, end, codes2.begin() + max_displacement, [](char r) { return detail::encode_residue(r); });
+			return std::span<const uint8_t>(codes2);
+		};
+
+		aligned_oriented_score_t parallel_score, antiparallel_score;
+
+		if (orientation == Orientation::antiparallel || orientation == Orientation::both) {
+			antiparallel_score = { score_oriented(padded1, pad(chain2.rbegin(), chain2.rend()), alignment, truncate), Orientation::antiparallel };
+		}
+
+		if (orientation == Orientation::parallel || orientation == Orientation::both) {
+			parallel_score = { score_oriented(padded1, pad(chain2.begin(), chain2.end()), alignment, truncate), Orientation::parallel };
+		}
+
+		return antiparallel_score.score < parallel_score.score ? antiparallel_score : parallel_score;
+	}
+
+	size_t profile_count() const
+	{
+		return profiles.size();
+	}
+};
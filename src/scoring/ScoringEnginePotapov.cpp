@@ -1,16 +1,23 @@
 #include "ScoringEnginePotapov.h"
 #include "PotapovScores.h"
 
+#include <cmath>
 #include <limits>
 #include <string>
 #include <tuple>
+#include <type_traits>
 
+#include <cassert>
 #include <cfenv>
 #include <cstdlib>
 
+#if defined(POTAPOV_AVX2_KERNEL) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
 using std::string_view;
 
-ScoringEnginePotapov::ScoringEnginePotapov()
+ScoringEnginePotapov::ScoringEnginePotapov(ScoringOptions::Precision precision) : precision(precision)
 {
 	pair_weights.reserve(8);
 	triple_weights.reserve(10);
@@ -29,46 +36,523 @@ ScoringEnginePotapov::ScoringEnginePotapov()
 
 	init_pairs();
 	init_triples();
+
+	compile(pairs, pair_weights, compiled_pairs);
+	compile(triples, triple_weights, compiled_triples);
+
+	quantize(compiled_pairs);
+	quantize(compiled_triples);
 }
 
 template <int k, typename weights_type>
-float ScoringEnginePotapov::generic_score(string_view chain1, string_view chain2, std::vector<ResidueTuple<k>>& tuples, weights_type& weight_vec)
+void ScoringEnginePotapov::compile(const std::vector<ResidueTuple<k>>& tuples, const weights_type& weight_vec, CompiledTuples<k>& compiled)
 {
-	string_view chains[] = { chain1, chain2 };
+	const size_t table_size = detail::pow_v<size_t, padded_alphabet_size, k>;
 
-	float res = 0;
+	//re-index the weight tables over the padded alphabet, so that any tuple touching a gap scores 0
+	compiled.weights.assign(weight_vec.size() * table_size, 0.f);
+	for (size_t w = 0; w < weight_vec.size(); w++)
+	{
+		for (size_t h = 0; h < weight_vec[w].size(); h++)
+		{
+			size_t padded_h = 0, rest = h;
+			for (size_t scale = 1, padded_scale = 1; scale < weight_vec[w].size(); scale *= 20, padded_scale *= padded_alphabet_size)
+			{
+				padded_h += (rest % 20) * padded_scale;
+				rest /= 20;
+			}
+			compiled.weights[w * table_size + padded_h] = weight_vec[w][h];
+		}
+	}
 
-	auto max_length = std::max(chain1.length(), chain2.length());
-	for (const auto& tuple : tuples)
+	for (auto& idx : compiled.residue_idx)
 	{
-		if (tuple.max_pos() >= max_length)
-			break;
-		auto& weight_array = weight_vec[tuple.weight_array_index];
+		idx.clear();
+		idx.reserve(tuples.size());
+	}
+	compiled.weight_offset.clear();
+	compiled.weight_offset.reserve(tuples.size());
 
-		char buf[k];
+	for (const auto& tuple : tuples)
+	{
 		for (int i = 0; i < k; i++)
 		{
-			auto chain_id = tuple.res[i].chain_id;
-			auto pos = tuple.res[i].pos;
+			compiled.residue_idx[i].push_back(tuple.res[i].chain_id * max_peptide_length + tuple.res[i].pos);
+		}
+		compiled.weight_offset.push_back(static_cast<uint32_t>(tuple.weight_array_index * table_size));
+	}
+
+	//tuples are sorted on max_pos, so the ones usable for a given length form a prefix
+	size_t count = 0;
+	for (size_t length = 0; length <= max_peptide_length; length++)
+	{
+		while (count < tuples.size() && tuples[count].max_pos() < length) count++;
+		compiled.count_by_length[length] = static_cast<uint32_t>(count);
+	}
+}
 
-			if (pos >= chains[chain_id].size() || chains[chain_id][pos] == '-')
-				goto skip;
+template <int k>
+void ScoringEnginePotapov::quantize(CompiledTuples<k>& compiled)
+{
+	auto round_weights = [&](auto& quantized) {
+		using weight_t = typename std::remove_reference_t<decltype(quantized)>::value_type;
+
+		float max_weight = 0;
+		for (float w : compiled.weights) max_weight = std::max(max_weight, std::abs(w));
+		compiled.scale = max_weight / std::numeric_limits<weight_t>::max();
+
+		//the largest rounding error within each weight table, bounding that of any tuple using it
+		const size_t table_size = detail::pow_v<size_t, padded_alphabet_size, k>;
+		std::vector<float> table_error(compiled.weights.size() / table_size, 0.f);
+
+		quantized.resize(compiled.weights.size() + 4 / sizeof(weight_t), 0);
+		for (size_t i = 0; i < compiled.weights.size(); i++)
+		{
+			quantized[i] = static_cast<weight_t>(std::lround(compiled.weights[i] / compiled.scale));
+			float& error = table_error[i / table_size];
+			error = std::max(error, std::abs(quantized[i] * compiled.scale - compiled.weights[i]));
+		}
 
-			buf[i] = chains[chain_id][pos];
+		float error = 0;
+		for (size_t length = 0, t = 0; length <= max_peptide_length; length++)
+		{
+			for (; t < compiled.count_by_length[length]; t++) error += table_error[compiled.weight_offset[t] / table_size];
+			compiled.error_by_length[length] = error;
 		}
+	};
+
+	switch (precision)
+	{
+	case ScoringOptions::Precision::int16:
+		round_weights(compiled.weights16);
+		break;
+	case ScoringOptions::Precision::int8:
+		round_weights(compiled.weights8);
+		break;
+	default:
+		break;
+	}
+}
+
+float ScoringEnginePotapov::max_error(size_t length) const
+{
+	if (precision == ScoringOptions::Precision::float32) return 0;
+
+	length = std::min<size_t>(length, max_peptide_length);
+	return compiled_pairs.error_by_length[length] + compiled_triples.error_by_length[length];
+}
+
+template <int k, typename F>
+float ScoringEnginePotapov::with_weights(const CompiledTuples<k>& compiled, F&& f) const
+{
+	switch (precision)
+	{
+	case ScoringOptions::Precision::int16:
+		return compiled.scale * f(compiled.weights16.data());
+	case ScoringOptions::Precision::int8:
+		return compiled.scale * f(compiled.weights8.data());
+	default:
+		return f(compiled.weights.data());
+	}
+}
+
+template <int k, typename weight_t>
+auto ScoringEnginePotapov::weight_sum(const uint8_t* codes1, const uint8_t* codes2, size_t length, const CompiledTuples<k>& compiled, const weight_t* weights) const
+{
+	const auto count = compiled.count_by_length[std::min<size_t>(length, max_peptide_length)];
+	const uint32_t* weight_offset = compiled.weight_offset.data();
 
-		res += weight_array[detail::residues_hash<k>({ buf, k })];
-	skip:
-		continue;
+	std::conditional_t<std::is_same_v<weight_t, float>, float, int32_t> res = 0;
+	for (uint32_t t = 0; t < count; t++)
+	{
+		uint32_t h = 0;
+		for (int i = 0; i < k; i++)
+		{
+			h = h * padded_alphabet_size + *residue_code(codes1, codes2, compiled.residue_idx[i][t], 1);
+		}
+		res += weights[weight_offset[t] + h];
 	}
 
 	return res;
 }
 
+template <int k>
+float ScoringEnginePotapov::compiled_score(const uint8_t* codes1, const uint8_t* codes2, size_t length, const CompiledTuples<k>& compiled) const
+{
+	return with_weights(compiled, [&](const auto* weights) { return weight_sum(codes1, codes2, length, compiled, weights); });
+}
+
+template <int k>
+void ScoringEnginePotapov::compiled_score_batch(const uint8_t* codes1, const uint8_t* codes2, const uint32_t* counts, const CompiledTuples<k>& compiled, float* out) const
+{
+	switch (precision)
+	{
+	case ScoringOptions::Precision::int16:
+		weight_sum_batch(codes1, codes2, counts, compiled, compiled.weights16.data(), compiled.scale, out);
+		break;
+	case ScoringOptions::Precision::int8:
+		weight_sum_batch(codes1, codes2, counts, compiled, compiled.weights8.data(), compiled.scale, out);
+		break;
+	default:
+		weight_sum_batch(codes1, codes2, counts, compiled, compiled.weights.data(), 1.f, out);
+		break;
+	}
+}
+
+std::pair<uint32_t, uint32_t> ScoringEnginePotapov::count_range(const uint32_t* counts)
+{
+	auto [min_count, max_count] = std::minmax_element(counts, counts + batch_size);
+	return { *min_count, *max_count };
+}
+
+template <int k, typename weight_t>
+void ScoringEnginePotapov::weight_sum_batch(const uint8_t* codes1, const uint8_t* codes2, const uint32_t* counts, const CompiledTuples<k>& compiled, const weight_t* weights, float scale, float* out) const
+{
+#if defined(__AVX512F__)
+	weight_sum_batch_avx512(codes1, codes2, counts, compiled, weights, scale, out);
+#elif defined(__AVX2__)
+	weight_sum_batch_avx2(codes1, codes2, counts, compiled, weights, scale, out);
+#else
+#if defined(POTAPOV_RUNTIME_AVX2)
+	static const bool has_avx2 = __builtin_cpu_supports("avx2");
+	if (has_avx2)
+	{
+		weight_sum_batch_avx2(codes1, codes2, counts, compiled, weights, scale, out);
+		return;
+	}
+#endif
+	weight_sum_batch_scalar(codes1, codes2, counts, compiled, weights, scale, out);
+#endif
+}
+
+template <int k, typename weight_t>
+void ScoringEnginePotapov::weight_sum_batch_scalar(const uint8_t* codes1, const uint8_t* codes2, const uint32_t* counts, const CompiledTuples<k>& compiled, const weight_t* weights, float scale, float* out) const
+{
+	const uint32_t* weight_offset = compiled.weight_offset.data();
+	constexpr bool quantized = !std::is_same_v<weight_t, float>;
+	const uint32_t max_count = count_range(counts).second;
+
+	std::conditional_t<quantized, int32_t, float> res[batch_size] = {};
+
+	for (uint32_t t = 0; t < max_count; t++)
+	{
+		for (size_t l = 0; l < batch_size; l++)
+		{
+			uint32_t h = 0;
+			for (int i = 0; i < k; i++)
+			{
+				h = h * padded_alphabet_size + residue_code(codes1, codes2, compiled.residue_idx[i][t], batch_size)[l];
+			}
+			res[l] += t < counts[l] ? weights[weight_offset[t] + h] : weight_t(0);
+		}
+	}
+
+	for (size_t l = 0; l < batch_size; l++)
+	{
+		out[l] = quantized ? res[l] * scale : res[l];
+	}
+}
+
+#if defined(POTAPOV_AVX2_KERNEL)
+template <int k, typename weight_t>
+POTAPOV_TARGET_AVX2 void ScoringEnginePotapov::weight_sum_batch_avx2(const uint8_t* codes1, const uint8_t* codes2, const uint32_t* counts, const CompiledTuples<k>& compiled, const weight_t* weights, float scale, float* out) const
+{
+	const uint32_t* weight_offset = compiled.weight_offset.data();
+	constexpr bool quantized = !std::is_same_v<weight_t, float>;
+	const auto [min_count, max_count] = count_range(counts);
+
+	const __m256i alphabet = _mm256_set1_epi32(padded_alphabet_size);
+	const __m256i lane_counts = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(counts));
+	__m256 res = _mm256_setzero_ps();
+	__m256i sum = _mm256_setzero_si256();
+
+	for (uint32_t t = 0; t < max_count; t++)
+	{
+		__m256i h = _mm256_setzero_si256();
+		for (int i = 0; i < k; i++)
+		{
+			__m256i c = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(residue_code(codes1, codes2, compiled.residue_idx[i][t], batch_size))));
+			h = _mm256_add_epi32(_mm256_mullo_epi32(h, alphabet), c);
+		}
+		h = _mm256_add_epi32(h, _mm256_set1_epi32(weight_offset[t]));
+
+		__m256i active = t < min_count ? _mm256_set1_epi32(-1) : _mm256_cmpgt_epi32(lane_counts, _mm256_set1_epi32(t));
+		if constexpr (quantized)
+		{
+			constexpr int shift = 32 - 8 * sizeof(weight_t);
+			__m256i w = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), reinterpret_cast<const int*>(weights), h, active, sizeof(weight_t));
+			sum = _mm256_add_epi32(sum, _mm256_srai_epi32(_mm256_slli_epi32(w, shift), shift));
+		}
+		else
+		{
+			res = _mm256_add_ps(res, _mm256_mask_i32gather_ps(_mm256_setzero_ps(), weights, h, _mm256_castsi256_ps(active), 4));
+		}
+	}
+
+	if constexpr (quantized) res = _mm256_mul_ps(_mm256_cvtepi32_ps(sum), _mm256_set1_ps(scale));
+	_mm256_storeu_ps(out, res);
+}
+#endif
+
+#if defined(__AVX512F__)
+template <int k, typename weight_t>
+void ScoringEnginePotapov::weight_sum_batch_avx512(const uint8_t* codes1, const uint8_t* codes2, const uint32_t* counts, const CompiledTuples<k>& compiled, const weight_t* weights, float scale, float* out) const
+{
+	const uint32_t* weight_offset = compiled.weight_offset.data();
+	constexpr bool quantized = !std::is_same_v<weight_t, float>;
+	const auto [min_count, max_count] = count_range(counts);
+
+	const __m512i alphabet = _mm512_set1_epi32(padded_alphabet_size);
+	const __m512i lane_counts = _mm512_loadu_si512(counts);
+	__m512 res = _mm512_setzero_ps();
+	__m512i sum = _mm512_setzero_si512();
+
+	for (uint32_t t = 0; t < max_count; t++)
+	{
+		__m512i h = _mm512_setzero_si512();
+		for (int i = 0; i < k; i++)
+		{
+			__m512i c = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(residue_code(codes1, codes2, compiled.residue_idx[i][t], batch_size))));
+			h = _mm512_add_epi32(_mm512_mullo_epi32(h, alphabet), c);
+		}
+		h = _mm512_add_epi32(h, _mm512_set1_epi32(weight_offset[t]));
+
+		__mmask16 active = t < min_count ? __mmask16(0xFFFF) : _mm512_cmplt_epu32_mask(_mm512_set1_epi32(t), lane_counts);
+		if constexpr (quantized)
+		{
+			constexpr int shift = 32 - 8 * sizeof(weight_t);
+			__m512i w = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), active, h, weights, sizeof(weight_t));
+			sum = _mm512_add_epi32(sum, _mm512_srai_epi32(_mm512_slli_epi32(w, shift), shift));
+		}
+		else
+		{
+			res = _mm512_add_ps(res, _mm512_mask_i32gather_ps(_mm512_setzero_ps(), active, h, weights, 4));
+		}
+	}
+
+	if constexpr (quantized) res = _mm512_mul_ps(_mm512_cvtepi32_ps(sum), _mm512_set1_ps(scale));
+	_mm512_storeu_ps(out, res);
+}
+#endif
+
+template <int k>
+float ScoringEnginePotapov::compiled_heptad_score(const uint8_t* codes, const CompiledTuples<k>& compiled, bool junction) const
+{
+	//no tuple spans more than a heptad, so everything starting in the first heptad ends before the third one
+	const auto count = compiled.count_by_length[14];
+
+	return with_weights(compiled, [&](const auto* weights) {
+		std::conditional_t<std::is_same_v<std::remove_cvref_t<decltype(*weights)>, float>, float, int32_t> res = 0;
+		for (uint32_t t = 0; t < count; t++)
+		{
+			uint32_t h = 0, first_pos = max_peptide_length, last_pos = 0;
+			for (int i = 0; i < k; i++)
+			{
+				uint32_t pos = compiled.residue_idx[i][t] % max_peptide_length;
+				first_pos = std::min(first_pos, pos);
+				last_pos = std::max(last_pos, pos);
+				h = h * padded_alphabet_size + codes[compiled.residue_idx[i][t]];
+			}
+			if (first_pos < 7 && (last_pos >= 7) == junction)
+			{
+				res += weights[compiled.weight_offset[t] + h];
+			}
+		}
+		return res;
+	});
+}
+
+template <int k>
+float ScoringEnginePotapov::weight(const CompiledTuples<k>& compiled, size_t idx) const
+{
+	switch (precision)
+	{
+	case ScoringOptions::Precision::int16:
+		return compiled.scale * compiled.weights16[idx];
+	case ScoringOptions::Precision::int8:
+		return compiled.scale * compiled.weights8[idx];
+	default:
+		return compiled.weights[idx];
+	}
+}
+
+template <int k>
+void ScoringEnginePotapov::compiled_profile(const uint8_t* codes1, const CompiledTuples<k>& compiled, Profile& out, std::vector<int32_t>& pair_table) const
+{
+	const size_t pair_table_size = padded_alphabet_size * padded_alphabet_size;
+	const auto count = compiled.count_by_length[out.length];
+
+	for (uint32_t t = 0; t < count; t++)
+	{
+		//the hash with the residues of the second chain left at 0, and where their digits go
+		uint32_t h = 0, digit = 1;
+		uint32_t free_digits[k];
+		uint16_t free_pos[k];
+		int free = 0;
+		bool gap = false;
+
+		for (int i = k - 1; i >= 0; i--, digit *= padded_alphabet_size)
+		{
+			uint32_t idx = compiled.residue_idx[i][t];
+			if (idx < max_peptide_length)
+			{
+				gap |= codes1[idx] == gap_code;
+				h += codes1[idx] * digit;
+			}
+			else
+			{
+				free_digits[free] = digit;
+				free_pos[free++] = uint16_t(idx - max_peptide_length);
+			}
+		}
+		//every pair and triple has residues on both chains, so there are one or two free ones, see init_pairs/init_triples
+		assert(free == 1 || free == 2);
+
+		//a gap makes every weight of the tuple 0
+		if (gap) continue;
+
+		const size_t offset = compiled.weight_offset[t] + h;
+		if (free == 1)
+		{
+			float* single = out.single.data() + free_pos[0] * padded_alphabet_size;
+			for (uint32_t c = 0; c < padded_alphabet_size; c++)
+			{
+				single[c] += weight(compiled, offset + c * free_digits[0]);
+			}
+		}
+		else
+		{
+			uint16_t low = std::min(free_pos[0], free_pos[1]), high = std::max(free_pos[0], free_pos[1]);
+			uint32_t low_digit = low == free_pos[0] ? free_digits[0] : free_digits[1];
+			uint32_t high_digit = low == free_pos[0] ? free_digits[1] : free_digits[0];
+
+			int32_t& table = pair_table[low * 7 + (high - low)];
+			if (table < 0)
+			{
+				table = int32_t(out.pair_positions.size());
+				out.pair_positions.push_back({ low, high });
+				out.pair_weights.resize(out.pair_weights.size() + pair_table_size, 0.f);
+			}
+
+			float* weights = out.pair_weights.data() + table * pair_table_size;
+			for (uint32_t c_low = 0; c_low < padded_alphabet_size; c_low++)
+			{
+				for (uint32_t c_high = 0; c_high < padded_alphabet_size; c_high++)
+				{
+					weights[c_low * padded_alphabet_size + c_high] += weight(compiled, offset + c_low * low_digit + c_high * high_digit);
+				}
+			}
+		}
+	}
+}
+
+void ScoringEnginePotapov::profile(const uint8_t* codes1, size_t length, Profile& out) const
+{
+	out.length = std::min<size_t>(length, max_peptide_length);
+	out.single.assign(out.length * padded_alphabet_size, 0.f);
+	out.pair_positions.clear();
+	out.pair_weights.clear();
+
+	//the two residues of a tuple on one chain are less than a heptad apart
+	std::vector<int32_t> pair_table(out.length * 7, -1);
+	compiled_profile(codes1, compiled_pairs, out, pair_table);
+	compiled_profile(codes1, compiled_triples, out, pair_table);
+}
+
+float ScoringEnginePotapov::score(const Profile& profile, const uint8_t* codes2) const
+{
+	const size_t pair_table_size = padded_alphabet_size * padded_alphabet_size;
+
+	float res = 0;
+	for (size_t pos = 0; pos < profile.length; pos++)
+	{
+		res += profile.single[pos * padded_alphabet_size + codes2[pos]];
+	}
+	for (size_t p = 0; p < profile.pair_positions.size(); p++)
+	{
+		auto [low, high] = profile.pair_positions[p];
+		res += profile.pair_weights[p * pair_table_size + codes2[low] * padded_alphabet_size + codes2[high]];
+	}
+
+	return w0 + res;
+}
+
+float ScoringEnginePotapov::heptad_score(const uint8_t* codes, bool junction) const
+{
+	return compiled_heptad_score(codes, compiled_pairs, junction) + compiled_heptad_score(codes, compiled_triples, junction);
+}
+
+void ScoringEnginePotapov::encode(string_view chain, uint8_t* dst, size_t stride, size_t length)
+{
+	length = std::min<size_t>(length, max_peptide_length);
+	size_t n = std::min(chain.length(), length);
+	for (size_t i = 0; i < n; i++)
+	{
+		dst[i * stride] = detail::encode_residue(chain[i]);
+	}
+	for (size_t i = n; i < length; i++)
+	{
+		dst[i * stride] = gap_code;
+	}
+}
+
+float ScoringEnginePotapov::score(const uint8_t* codes, size_t length) const
+{
+	return score(codes, codes + max_peptide_length, length);
+}
+
+float ScoringEnginePotapov::score(const uint8_t* codes1, const uint8_t* codes2, size_t length) const
+{
+	return w0 + compiled_score(codes1, codes2, length, compiled_pairs) + compiled_score(codes1, codes2, length, compiled_triples);
+}
+
+void ScoringEnginePotapov::score_displacements(const uint8_t* codes1, const uint8_t* codes2, std::span<const ScoringOptions::window_t> windows, const size_t* lengths, float* out) const
+{
+	for (size_t w = 0; w < windows.size(); w++)
+	{
+		out[w] = score(codes1 + windows[w].start1, codes2 + windows[w].start2, lengths[w]);
+	}
+}
+
+void ScoringEnginePotapov::score_batch(const uint8_t* codes, const size_t* lengths, float* out) const
+{
+	score_batch(codes, codes + max_peptide_length * batch_size, lengths, out);
+}
+
+void ScoringEnginePotapov::score_batch_displacements(const uint8_t* codes1, const uint8_t* codes2, std::span<const ScoringOptions::window_t> windows, const size_t* lengths, float* out) const
+{
+	for (size_t w = 0; w < windows.size(); w++)
+	{
+		score_batch(codes1 + windows[w].start1 * batch_size, codes2 + windows[w].start2 * batch_size, lengths + w * batch_size, out + w * batch_size);
+	}
+}
+
+void ScoringEnginePotapov::score_batch(const uint8_t* codes1, const uint8_t* codes2, const size_t* lengths, float* out) const
+{
+	uint32_t pair_counts[batch_size], triple_counts[batch_size];
+	for (size_t l = 0; l < batch_size; l++)
+	{
+		auto length = std::min<size_t>(lengths[l], max_peptide_length);
+		pair_counts[l] = compiled_pairs.count_by_length[length];
+		triple_counts[l] = compiled_triples.count_by_length[length];
+	}
+
+	float pair_scores[batch_size], triple_scores[batch_size];
+	compiled_score_batch(codes1, codes2, pair_counts, compiled_pairs, pair_scores);
+	compiled_score_batch(codes1, codes2, triple_counts, compiled_triples, triple_scores);
+
+	for (size_t l = 0; l < batch_size; l++)
+	{
+		out[l] = w0 + pair_scores[l] + triple_scores[l];
+	}
+}
+
 float ScoringEnginePotapov::score(string_view chain1, string_view chain2)
 {
-	const float w0 = -4.54197f;
-	return w0 + generic_score(chain1, chain2, pairs, pair_weights) + generic_score(chain1, chain2, triples, triple_weights);
+	uint8_t codes[2 * max_peptide_length];
+	encode(chain1, codes);
+	encode(chain2, codes + max_peptide_length);
+	return score(codes, std::max(chain1.length(), chain2.length()));
 }
 
 int ScoringEnginePotapov::register_idx(std::string_view registers, std::map<std::string, int>& rmap)
@@ -2,20 +2,104 @@
 
 #include <algorithm>
 #include <map>
+#include <span>
 #include <vector>
 
 #include "ScoringHelper.h"
 
+// The batch kernel comes in AVX-512, AVX2 and portable flavours. AVX-512 is only used when compiling for it, AVX2
+// also when not: on x86-64 the AVX2 kernel is then built for that target alone and picked if the CPU has it.
+#if defined(__AVX512F__)
+#elif defined(__AVX2__)
+#define POTAPOV_AVX2_KERNEL
+#define POTAPOV_TARGET_AVX2
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define POTAPOV_AVX2_KERNEL
+#define POTAPOV_RUNTIME_AVX2
+#define POTAPOV_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
 struct ScoringEnginePotapov {
 	using string_view = std::string_view;
 
 public:
 	const static int max_peptide_length = 100;
 
-	ScoringEnginePotapov();
+	// residue code used for gaps ('-') and for positions past the end of a chain
+	const static uint8_t gap_code = 20;
+	const static int padded_alphabet_size = 21;
+
+	// constant term added to every score
+	constexpr static float w0 = -4.54197f;
+
+	// At int16 and int8 precision, the pair and the triple weight tables are each stored as integer multiples of one
+	// scale, their largest weight over 32767 or 127, which shrinks the triple tables from 370 KB to 185 KB or 93 KB.
+	// The weights of a score are then summed as integers, and the score differs from the float one by at most
+	// max_error() of its length.
+	explicit ScoringEnginePotapov(ScoringOptions::Precision precision = ScoringOptions::Precision::float32);
+
+	// bound on the difference between the scores at this precision and the float ones, for chains of the given length,
+	// leaving aside float rounding
+	float max_error(size_t length) const;
 
 	float score(string_view chain1, string_view chain2);
 
+	// codes holds both chains as produced by encode(), the second one starting at max_peptide_length
+	float score(const uint8_t* codes, size_t length) const;
+
+	// same, with the two chains in separate buffers
+	float score(const uint8_t* codes1, const uint8_t* codes2, size_t length) const;
+
+	// scores one pair of padded chains at every displacement at once, reading the window of each displacement in place
+	// instead of copying it out; window w starts at windows[w] and is lengths[w] long
+	void score_displacements(const uint8_t* codes1, const uint8_t* codes2, std::span<const ScoringOptions::window_t> windows, const size_t* lengths, float* out) const;
+
+	// number of chain pairs scored at once by score_batch, matching the widest available SIMD registers
+#if defined(__AVX512F__)
+	const static size_t batch_size = 16;
+#else
+	const static size_t batch_size = 8;
+#endif
+
+	// codes holds batch_size chain pairs interleaved, the code at buffer position idx of pair l being codes[idx * batch_size + l]
+	void score_batch(const uint8_t* codes, const size_t* lengths, float* out) const;
+
+	// same, with the two chains in separate buffers laid out like codes
+	void score_batch(const uint8_t* codes1, const uint8_t* codes2, const size_t* lengths, float* out) const;
+
+	// score_displacements for batch_size interleaved pairs of padded chains, the lanes sharing the window starts;
+	// lengths and out hold batch_size entries per window
+	void score_batch_displacements(const uint8_t* codes1, const uint8_t* codes2, std::span<const ScoringOptions::window_t> windows, const size_t* lengths, float* out) const;
+
+	// writes the first length residue codes of the chain to dst (every stride-th byte), padding it with gap_code
+	static void encode(string_view chain, uint8_t* dst, size_t stride = 1, size_t length = max_peptide_length);
+
+	// The tuples of score(codes1, codes2, length) for one fixed first chain, reduced to tables over the residues of the
+	// second chain. Every tuple has one or two residues there, and the weights of the tuples sharing those positions
+	// are summed into one table over their codes, so a second chain costs a lookup per position, plus one per pair of
+	// positions sharing a triple, instead of a gather per tuple. The weights being summed in another order, scores
+	// can differ from score() in the last bits.
+	struct Profile {
+		size_t length = 0;
+		// summed weights by position in the second chain and residue code there
+		std::vector<float> single;
+		// the positions of each table over two residues of the second chain, the lower one first
+		std::vector<std::array<uint16_t, 2>> pair_positions;
+		// the tables of pair_positions, indexed by the code at the lower position times padded_alphabet_size plus the other
+		std::vector<float> pair_weights;
+	};
+
+	// builds the profile of the first chain, laid out as in score(), for windows of the given length
+	void profile(const uint8_t* codes1, size_t length, Profile& out) const;
+
+	// score(codes1, codes2, length) with the codes1 and length the profile was built for
+	float score(const Profile& profile, const uint8_t* codes2) const;
+
+	// The tuples repeat with every heptad, so the score of chains made of whole heptads is w0 plus, for each heptad
+	// position, the weights of the tuples within it and of those reaching into the next one. For codes laid out as
+	// in score(), this returns the former (junction = false) or the latter (junction = true) for the first heptad.
+	float heptad_score(const uint8_t* codes, bool junction) const;
+
 private:
 
 	template<size_t k>
@@ -68,8 +152,90 @@ private:
 	void init_pairs();
 	void init_triples();
 
+	// flattened form of a sorted tuple list, which the scoring loop can walk without any branches
+	template<int k>
+	struct CompiledTuples {
+		// position of each residue in the encoded chain buffer (chain_id * max_peptide_length + pos)
+		std::array<std::vector<uint16_t>, k> residue_idx;
+		// start of the tuple's weight table in the flattened weights
+		std::vector<uint32_t> weight_offset;
+		// number of leading tuples that fit within chains of the given length
+		std::array<uint32_t, max_peptide_length + 1> count_by_length;
+		// all weight tables, indexed over the padded alphabet, gap entries being zero
+		std::vector<float> weights;
+		// at int16 / int8 precision, the weights in multiples of scale, rounded; the batch kernels read each weight as the
+		// low bytes of a 32 bit word, so a few zeros follow the last one
+		std::vector<int16_t> weights16;
+		std::vector<int8_t> weights8;
+		float scale = 1;
+		// bound on the rounding error of the tuples counted for the given length, summed
+		std::array<float, max_peptide_length + 1> error_by_length = {};
+	};
+
+	CompiledTuples<2> compiled_pairs;
+	CompiledTuples<3> compiled_triples;
+
+	// where the code at the given residue index lies, with codes of lanes interleaved every stride bytes
+	static const uint8_t* residue_code(const uint8_t* codes1, const uint8_t* codes2, uint32_t residue_idx, size_t stride)
+	{
+		return residue_idx < max_peptide_length ? codes1 + residue_idx * stride : codes2 + (residue_idx - max_peptide_length) * stride;
+	}
+
+	ScoringOptions::Precision precision;
+
 	template<int k, typename weights_type>
-	float generic_score(string_view chain1, string_view chain2, std::vector<ResidueTuple<k>>& tuples, weights_type& weight_vec);
+	void compile(const std::vector<ResidueTuple<k>>& tuples, const weights_type& weight_vec, CompiledTuples<k>& compiled);
+
+	template<int k>
+	void quantize(CompiledTuples<k>& compiled);
+
+	// calls f with the weights of compiled at the engine's precision, returning its result times their scale
+	template<int k, typename F>
+	float with_weights(const CompiledTuples<k>& compiled, F&& f) const;
+
+	template<int k>
+	float compiled_score(const uint8_t* codes1, const uint8_t* codes2, size_t length, const CompiledTuples<k>& compiled) const;
+
+	// weight idx of the compiled tables at the engine's precision
+	template<int k>
+	float weight(const CompiledTuples<k>& compiled, size_t idx) const;
+
+	// adds the tuples of compiled to a profile; pair_table maps pairs of positions to their tables, see profile()
+	template<int k>
+	void compiled_profile(const uint8_t* codes1, const CompiledTuples<k>& compiled, Profile& out, std::vector<int32_t>& pair_table) const;
+
+	template<int k>
+	float compiled_heptad_score(const uint8_t* codes, const CompiledTuples<k>& compiled, bool junction) const;
+
+	template<int k>
+	void compiled_score_batch(const uint8_t* codes1, const uint8_t* codes2, const uint32_t* counts, const CompiledTuples<k>& compiled, float* out) const;
+
+	// the sums behind compiled_score and compiled_score_batch, over float weights or integer ones, the latter being
+	// accumulated as integers; weight_sum_batch hands them out multiplied by scale
+	template<int k, typename weight_t>
+	auto weight_sum(const uint8_t* codes1, const uint8_t* codes2, size_t length, const CompiledTuples<k>& compiled, const weight_t* weights) const;
+
+	template<int k, typename weight_t>
+	void weight_sum_batch(const uint8_t* codes1, const uint8_t* codes2, const uint32_t* counts, const CompiledTuples<k>& compiled, const weight_t* weights, float scale, float* out) const;
+
+	// The kernels weight_sum_batch picks from. Every lane adds the same tuples in the same order as compiled_score,
+	// lanes past their count adding 0. There are no gathers of narrower integers, so the SIMD kernels gather integer
+	// weights as the low bytes of 32 bit words and sign extend them by shifting them up and back down.
+	template<int k, typename weight_t>
+	void weight_sum_batch_scalar(const uint8_t* codes1, const uint8_t* codes2, const uint32_t* counts, const CompiledTuples<k>& compiled, const weight_t* weights, float scale, float* out) const;
+
+#if defined(POTAPOV_AVX2_KERNEL)
+	template<int k, typename weight_t>
+	POTAPOV_TARGET_AVX2 void weight_sum_batch_avx2(const uint8_t* codes1, const uint8_t* codes2, const uint32_t* counts, const CompiledTuples<k>& compiled, const weight_t* weights, float scale, float* out) const;
+#endif
+
+#if defined(__AVX512F__)
+	template<int k, typename weight_t>
+	void weight_sum_batch_avx512(const uint8_t* codes1, const uint8_t* codes2, const uint32_t* counts, const CompiledTuples<k>& compiled, const weight_t* weights, float scale, float* out) const;
+#endif
+
+	// the fewest and the most tuples any lane of a batch adds
+	static std::pair<uint32_t, uint32_t> count_range(const uint32_t* counts);
 
 	std::vector<std::array<float, 20 * 20>> pair_weights;
 	std::map<std::string, int> pair_register_map;
@@ -1,14 +1,18 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <cstring>
 #include <iostream>
 #include <map>
+#include <span>
 #include <string>
 #include <string_view>
 #include <tuple>
 #include <vector>
 
+#include "common/PeptideSet.h"
+
 namespace detail {
 	inline uint8_t residue_code(const char r) {
 		//The amino acid alphabet is ACDEFGHIKLMNPQRSTVWY
@@ -17,6 +21,22 @@ namespace detail {
 		return map[r - 'A'];
 	}
 
+	//gaps ('-') get their own code, following the 20 residues
+	constexpr uint8_t gap_code = 20;
+
+	//anything but an uppercase letter, lowercase residues included, is scored like a gap
+	inline uint8_t encode_residue(const char r) {
+		return r >= 'A' && r <= 'Z' ? residue_code(r) : gap_code;
+	}
+
+	inline bool is_gap(const char r) {
+		return r == '-';
+	}
+
+	inline bool is_gap(const uint8_t code) {
+		return code == gap_code;
+	}
+
 	template<int len>
 	int residues_hash(std::string_view residues);
 
@@ -68,7 +88,17 @@ namespace ScoringOptions {
 		{}
 	};
 
+	// where the part of two padded chains that one displacement scores starts in each of them
+	struct window_t {
+		size_t start1, start2;
+
+		bool operator==(const window_t&) const = default;
+	};
+
 	enum class ScoreFunc { potapov, bcipa, qcipa, icipa_core_vert, icipa_nter_core };
+
+	// how the Potapov weight tables are stored and summed
+	enum class Precision { float32, int16, int8 };
 }
 
 template<typename ScoringEngine>
@@ -78,39 +108,48 @@ struct ScoringHelper {
 	using alignment_t = ScoringOptions::alignment_t;
 	using aligned_score_t = ScoringOptions::aligned_score_t;
 	using aligned_oriented_score_t = ScoringOptions::aligned_oriented_score_t;
+	using window_t = ScoringOptions::window_t;
 
 	ScoringEngine sc;
 
 	template<typename... Args>
 	ScoringHelper(Args&&... args) : sc(std::forward<Args>(args)...) {}
 
+	// every chain is padded with this many gaps on both sides before aligning
+	const static int max_displacement = 7;
+
 	// this assumes that chain1 and chain2 are of the same length
-	std::pair<std::string_view, std::string_view> align_truncate(std::string_view chain1, std::string_view chain2, alignment_t alignment, bool truncate) {
+	// Chain is either a string_view of residue letters or a span of residue codes
+	template<typename Chain>
+	std::pair<Chain, Chain> align_truncate(Chain chain1, Chain chain2, alignment_t alignment, bool truncate) {
+		auto remove_prefix = [](Chain& chain, size_t count) { chain = Chain(chain.data() + count, chain.size() - count); };
+		auto remove_suffix = [](Chain& chain, size_t count) { chain = Chain(chain.data(), chain.size() - count); };
+
 		if (alignment > 0) {
-			chain1.remove_prefix(alignment);
-			chain2.remove_suffix(alignment);
+			remove_prefix(chain1, alignment);
+			remove_suffix(chain2, alignment);
 		}
 		else {
-			chain1.remove_suffix(-alignment);
-			chain2.remove_prefix(-alignment);
+			remove_suffix(chain1, -alignment);
+			remove_prefix(chain2, -alignment);
 		}
 
 		if (truncate) {
-			auto length = chain1.length();
+			auto length = chain1.size();
 
 			int left_overhang = 0;
-			while (left_overhang + 7 <= length && (*(chain1.begin() + 6) == '-' || *(chain2.begin() + 6) == '-')) {
-				chain1.remove_prefix(7);
-				chain2.remove_prefix(7);
+			while (left_overhang + 7 <= length && (detail::is_gap(*(chain1.begin() + 6)) || detail::is_gap(*(chain2.begin() + 6)))) {
+				remove_prefix(chain1, 7);
+				remove_prefix(chain2, 7);
 				left_overhang += 7;
 			}
 
-			length = chain1.length();
+			length = chain1.size();
 			int right_overhang = 0;
 
-			while (right_overhang + 7 <= length && (*(chain1.rbegin() + 6) == '-' || *(chain2.rbegin() + 6) == '-')) {
-				chain1.remove_suffix(7);
-				chain2.remove_suffix(7);
+			while (right_overhang + 7 <= length && (detail::is_gap(*(chain1.rbegin() + 6)) || detail::is_gap(*(chain2.rbegin() + 6)))) {
+				remove_suffix(chain1, 7);
+				remove_suffix(chain2, 7);
 				right_overhang += 7;
 			}
 		}
@@ -119,7 +158,12 @@ struct ScoringHelper {
 
 	aligned_score_t score(std::string_view chain1, std::string_view chain2, const std::vector<alignment_t>& alignment, bool truncate)
 	{
-		const auto max_displacement = 7;
+		if constexpr (requires { &ScoringEngine::score_displacements; }) {
+			aligned_score_t parallel_best, antiparallel_best;
+			score_displacements(chain1, chain2, alignment, truncate, Orientation::parallel, &parallel_best, &antiparallel_best);
+			return parallel_best;
+		}
+
 		auto n1 = chain1.length(), n2 = chain2.length(), n = std::max(n1, n2);
 		auto buffer_size = n + 2 * max_displacement;
 
@@ -134,8 +178,9 @@ struct ScoringHelper {
 
 		aligned_score_t best_score{ std::numeric_limits<float>::infinity(), 0 };
 
-		const std::string_view padded_chain1{ buf1.data(), buf1.size() };
-		const std::string_view padded_chain2{ buf2.data(), buf2.size() };
+		// the buffers only ever grow, so anything past buffer_size is left over from longer chains
+		const std::string_view padded_chain1{ buf1.data(), buffer_size };
+		const std::string_view padded_chain2{ buf2.data(), buffer_size };
 
 		for (auto displacement : alignment) {
 			auto [aligned_chain1, aligned_chain2] = align_truncate(padded_chain1, padded_chain2, displacement, truncate);
@@ -150,6 +195,14 @@ struct ScoringHelper {
 
 	aligned_oriented_score_t score(std::string_view chain1, std::string_view chain2, const std::vector<alignment_t>& alignment, bool truncate, Orientation orientation)
 	{
+		if constexpr (requires { &ScoringEngine::score_displacements; }) {
+			aligned_score_t parallel_best, antiparallel_best;
+			aligned_oriented_score_t best;
+			score_displacements(chain1, chain2, alignment, truncate, orientation, &parallel_best, &antiparallel_best);
+			combine_orientations(orientation, &antiparallel_best, &parallel_best, 1, &best);
+			return best;
+		}
+
 		static thread_local std::string buf;
 		aligned_oriented_score_t parallel_score, antiparallel_score;
 
@@ -169,4 +222,284 @@ struct ScoringHelper {
 			return parallel_score;
 		}
 	}
+
+	// scores chain1 against every chain in chains2, engines with a score_batch kernel take batch_size partners at a time
+	void score_batch(std::string_view chain1, std::span<const std::string_view> chains2, const std::vector<alignment_t>& alignment, bool truncate, Orientation orientation, aligned_oriented_score_t* best)
+	{
+		if constexpr (requires { ScoringEngine::batch_size; }) {
+			const size_t batch_size = ScoringEngine::batch_size;
+			for (size_t first = 0; first < chains2.size(); first += batch_size) {
+				auto count = std::min(batch_size, chains2.size() - first);
+				score_block(chain1, chains2.subspan(first, count), alignment, truncate, orientation, best + first);
+			}
+		}
+		else {
+			for (size_t j = 0; j < chains2.size(); j++) {
+				best[j] = score(chain1, chains2[j], alignment, truncate, orientation);
+			}
+		}
+	}
+
+	// builds the residue code arena of the peptide set, which the score_batch overload below scores from
+	static void encode(PeptideSet& ps)
+	{
+		ps.encode(detail::encode_residue, detail::gap_code, max_displacement);
+	}
+
+	// scores peptide i of an encoded set against peptides [first, last), without re-encoding or copying any sequences
+	void score_batch(const PeptideSet& ps, size_t i, size_t first, size_t last, const std::vector<alignment_t>& alignment, bool truncate, Orientation orientation, aligned_oriented_score_t* best)
+	{
+		if constexpr (requires { ScoringEngine::batch_size; }) {
+			const size_t batch_size = ScoringEngine::batch_size;
+			for (size_t block = first; block < last; block += batch_size) {
+				auto count = std::min(batch_size, last - block);
+				score_encoded_block(ps, i, block, count, alignment, truncate, orientation, best + (block - first));
+			}
+		}
+		else if constexpr (requires { &ScoringEngine::score_displacements; }) {
+			// the arena holds every peptide forward and reversed, so pairs are scored straight from it
+			for (size_t j = first; j < last; j++) {
+				auto padded_length = std::max(ps[i].sequence.length(), ps[j].sequence.length()) + 2 * max_displacement;
+				const std::span<const uint8_t> padded2[2] = { ps.encoded(j).first(padded_length), ps.encoded(j, true).first(padded_length) };
+
+				aligned_score_t parallel_best, antiparallel_best;
+				score_displacements(ps.encoded(i).first(padded_length), padded2, alignment, truncate, orientation, &parallel_best, &antiparallel_best);
+				combine_orientations(orientation, &antiparallel_best, &parallel_best, 1, best + (j - first));
+			}
+		}
+		else {
+			for (size_t j = first; j < last; j++) {
+				best[j - first] = score(ps[i].sequence, ps[j].sequence, alignment, truncate, orientation);
+			}
+		}
+	}
+
+private:
+	static bool wants_orientation(Orientation orientation, Orientation wanted)
+	{
+		return orientation == wanted || orientation == Orientation::both;
+	}
+
+	// Pads and encodes the chains just once, reversing the second one straight into the codes for the antiparallel
+	// orientation, and has the engine score every displacement of the requested orientations on its window of them.
+	void score_displacements(std::string_view chain1, std::string_view chain2, const std::vector<alignment_t>& alignment, bool truncate, Orientation orientation, aligned_score_t* parallel_best, aligned_score_t* antiparallel_best)
+	{
+		auto buffer_size = std::max(chain1.length(), chain2.length()) + 2 * max_displacement;
+
+		static thread_local std::vector<uint8_t> buf1, buf2;
+
+		auto encode = [](char r) { return detail::encode_residue(r); };
+
+		// the reversed second chain follows the forward one in buf2
+		buf1.assign(buffer_size, detail::gap_code);
+		buf2.assign(2 * buffer_size, detail::gap_code);
+		std::transform(chain1.begin(), chain1.end(), buf1.begin() + max_displacement, encode);
+		std::transform(chain2.begin(), chain2.end(), buf2.begin() + max_displacement, encode);
+		std::transform(chain2.rbegin(), chain2.rend(), buf2.begin() + buffer_size + max_displacement, encode);
+
+		const std::span<const uint8_t> padded_chains2[2] = { std::span<const uint8_t>(buf2).first(buffer_size), std::span<const uint8_t>(buf2).subspan(buffer_size) };
+		score_displacements(std::span<const uint8_t>(buf1), padded_chains2, alignment, truncate, orientation, parallel_best, antiparallel_best);
+	}
+
+	// Scores padded chains at every displacement of the requested orientations in one engine call. padded2 holds the
+	// second chain forward and reversed, the reversed one lying after the forward one in memory.
+	void score_displacements(std::span<const uint8_t> padded1, const std::span<const uint8_t>* padded2, const std::vector<alignment_t>& alignment, bool truncate, Orientation orientation, aligned_score_t* parallel_best, aligned_score_t* antiparallel_best)
+	{
+		static thread_local std::vector<window_t> windows;
+		static thread_local std::vector<size_t> lengths;
+		static thread_local std::vector<float> scores;
+
+		const Orientation orientations[2] = { Orientation::parallel, Orientation::antiparallel };
+
+		windows.clear();
+		lengths.clear();
+		for (size_t o = 0; o < 2; o++) {
+			if (!wants_orientation(orientation, orientations[o])) continue;
+
+			for (auto displacement : alignment) {
+				auto [aligned_chain1, aligned_chain2] = align_truncate(padded1, padded2[o], displacement, truncate);
+				windows.push_back({ size_t(aligned_chain1.data() - padded1.data()), size_t(aligned_chain2.data() - padded2[0].data()) });
+				lengths.push_back(std::max(aligned_chain1.size(), aligned_chain2.size()));
+			}
+		}
+
+		scores.resize(windows.size());
+		sc.score_displacements(padded1.data(), padded2[0].data(), windows, lengths.data(), scores.data());
+
+		const float* oriented_scores = scores.data();
+		for (size_t o = 0; o < 2; o++) {
+			aligned_score_t& best_score = o == 0 ? *parallel_best : *antiparallel_best;
+			best_score = { std::numeric_limits<float>::infinity(), 0 };
+			if (!wants_orientation(orientation, orientations[o])) continue;
+
+			for (size_t d = 0; d < alignment.size(); d++) {
+				aligned_score_t current_score = { oriented_scores[d], alignment[d] };
+				if (current_score < best_score) best_score = current_score;
+			}
+			oriented_scores += alignment.size();
+		}
+	}
+
+	// Scores count lanes of padded chain pairs at every displacement, in the requested orientations. codes1 holds the
+	// transposed first chains and codes2 the transposed second chains, the reversed ones antiparallel_row rows after
+	// the forward ones; padded1 and padded2 give the same chains of each lane untransposed, for align_truncate.
+	// Lanes that align_truncate cuts alike share a window, so unless truncation tells them apart, each displacement is
+	// one engine pass per orientation, all of them in a single engine call.
+	void score_displacements_block(const uint8_t* codes1, const uint8_t* codes2, size_t antiparallel_row, const std::span<const uint8_t>* padded1, const std::span<const uint8_t>* const* padded2, size_t count, const std::vector<alignment_t>& alignment, bool truncate, Orientation orientation, aligned_oriented_score_t* best)
+	{
+		const size_t batch_size = ScoringEngine::batch_size;
+		const Orientation orientations[2] = { Orientation::parallel, Orientation::antiparallel };
+
+		static thread_local std::vector<window_t> windows;
+		static thread_local std::vector<size_t> lengths;
+		static thread_local std::vector<float> scores;
+		// the window each lane is scored on, for every orientation and displacement
+		static thread_local std::vector<size_t> lane_window;
+
+		windows.clear();
+		lengths.clear();
+		lane_window.resize(2 * alignment.size() * batch_size);
+
+		for (size_t o = 0; o < 2; o++) {
+			if (!wants_orientation(orientation, orientations[o])) continue;
+
+			for (size_t d = 0; d < alignment.size(); d++) {
+				size_t first_window = windows.size();
+				for (size_t l = 0; l < count; l++) {
+					auto [aligned_chain1, aligned_chain2] = align_truncate(padded1[l], padded2[o][l], alignment[d], truncate);
+					window_t window{ size_t(aligned_chain1.data() - padded1[l].data()), size_t(aligned_chain2.data() - padded2[o][l].data()) + o * antiparallel_row };
+
+					// lanes left out of a window keep length 0
+					size_t w = std::find(windows.begin() + first_window, windows.end(), window) - windows.begin();
+					if (w == windows.size()) {
+						windows.push_back(window);
+						lengths.resize(lengths.size() + batch_size, 0);
+					}
+					lengths[w * batch_size + l] = std::max(aligned_chain1.size(), aligned_chain2.size());
+					lane_window[(o * alignment.size() + d) * batch_size + l] = w;
+				}
+			}
+		}
+
+		scores.resize(windows.size() * batch_size);
+		sc.score_batch_displacements(codes1, codes2, windows, lengths.data(), scores.data());
+
+		aligned_score_t oriented_best[2][batch_size];
+		for (size_t o = 0; o < 2; o++) {
+			for (size_t l = 0; l < count; l++) {
+				oriented_best[o][l] = { std::numeric_limits<float>::infinity(), 0 };
+				if (!wants_orientation(orientation, orientations[o])) continue;
+
+				for (size_t d = 0; d < alignment.size(); d++) {
+					aligned_score_t current_score = { scores[lane_window[(o * alignment.size() + d) * batch_size + l] * batch_size + l], alignment[d] };
+					if (current_score < oriented_best[o][l]) oriented_best[o][l] = current_score;
+				}
+			}
+		}
+
+		combine_orientations(orientation, oriented_best[1], oriented_best[0], count, best);
+	}
+
+	// picks the better of the two orientations for each of the count partners, like the single pair score() does
+	static void combine_orientations(Orientation orientation, const aligned_score_t* antiparallel_best, const aligned_score_t* parallel_best, size_t count, aligned_oriented_score_t* best)
+	{
+		bool antiparallel = wants_orientation(orientation, Orientation::antiparallel);
+		bool parallel = wants_orientation(orientation, Orientation::parallel);
+
+		for (size_t l = 0; l < count; l++) {
+			aligned_oriented_score_t antiparallel_score, parallel_score;
+			if (antiparallel) antiparallel_score = { antiparallel_best[l], Orientation::antiparallel };
+			if (parallel) parallel_score = { parallel_best[l], Orientation::parallel };
+
+			best[l] = antiparallel_score.score < parallel_score.score ? antiparallel_score : parallel_score;
+		}
+	}
+
+	// Transposes the padded chains of count lanes for score_displacements_block: the first chain, which all lanes share
+	// and which is at least padded_length long, into every lane of codes1, and the second chains of the requested
+	// orientations into codes2, the reversed ones padded_length rows on.
+	void transpose(std::span<const uint8_t> padded1, const std::span<const uint8_t>* const* padded2, size_t count, size_t padded_length, Orientation orientation, std::vector<uint8_t>& codes1, std::vector<uint8_t>& codes2)
+	{
+		const size_t batch_size = ScoringEngine::batch_size;
+		const Orientation orientations[2] = { Orientation::parallel, Orientation::antiparallel };
+
+		// past its own padded length, each lane keeps whatever codes it last held, which it never reads
+		if (codes1.size() < padded_length * batch_size) codes1.resize(padded_length * batch_size, detail::gap_code);
+		if (codes2.size() < 2 * padded_length * batch_size) codes2.resize(2 * padded_length * batch_size, detail::gap_code);
+
+		for (size_t p = 0; p < padded_length; p++) {
+			memset(codes1.data() + p * batch_size, padded1[p], batch_size);
+		}
+
+		for (size_t l = 0; l < count; l++) {
+			for (size_t o = 0; o < 2; o++) {
+				if (!wants_orientation(orientation, orientations[o])) continue;
+
+				uint8_t* dst = codes2.data() + o * padded_length * batch_size + l;
+				for (size_t p = 0; p < padded2[o][l].size(); p++) {
+					dst[p * batch_size] = padded2[o][l][p];
+				}
+			}
+		}
+	}
+
+	// same as score_block, taking the padded chains straight from the arena of the peptide set, the reversed ones included
+	void score_encoded_block(const PeptideSet& ps, size_t i, size_t first, size_t count, const std::vector<alignment_t>& alignment, bool truncate, Orientation orientation, aligned_oriented_score_t* best)
+	{
+		const size_t batch_size = ScoringEngine::batch_size;
+
+		static thread_local std::vector<uint8_t> codes1, codes2;
+
+		std::span<const uint8_t> padded1[batch_size], parallel2[batch_size], antiparallel2[batch_size];
+		const std::span<const uint8_t>* padded2[2] = { parallel2, antiparallel2 };
+		size_t padded_length = 0;
+
+		for (size_t l = 0; l < count; l++) {
+			auto n = std::max(ps[i].sequence.length(), ps[first + l].sequence.length());
+			padded1[l] = ps.encoded(i).first(n + 2 * max_displacement);
+			parallel2[l] = ps.encoded(first + l).first(n + 2 * max_displacement);
+			antiparallel2[l] = ps.encoded(first + l, true).first(n + 2 * max_displacement);
+			padded_length = std::max(padded_length, padded1[l].size());
+		}
+
+		transpose(ps.encoded(i), padded2, count, padded_length, orientation, codes1, codes2);
+		score_displacements_block(codes1.data(), codes2.data(), padded_length, padded1, padded2, count, alignment, truncate, orientation, best);
+	}
+
+	// same as score() for each of up to batch_size partners, with all of them going through the engine at once
+	void score_block(std::string_view chain1, std::span<const std::string_view> chains2, const std::vector<alignment_t>& alignment, bool truncate, Orientation orientation, aligned_oriented_score_t* best)
+	{
+		const size_t batch_size = ScoringEngine::batch_size;
+
+		// the chains padded and encoded, the first one to the longest pair and the second one of every lane in both orientations
+		static thread_local std::vector<uint8_t> encoded1, encoded2[2][batch_size];
+		static thread_local std::vector<uint8_t> codes1, codes2;
+
+		std::span<const uint8_t> padded1[batch_size], parallel2[batch_size], antiparallel2[batch_size];
+		const std::span<const uint8_t>* padded2[2] = { parallel2, antiparallel2 };
+		size_t padded_length = 0;
+
+		auto pad = [](auto begin, auto end, size_t padded_size, std::vector<uint8_t>& buf) {
+			buf.assign(padded_size, detail::gap_code);
+			std::transform(begin, end, buf.begin() + max_displacement, [](char r) { return detail::encode_residue(r); });
+			return std::span<const uint8_t>(buf);
+		};
+
+		for (size_t l = 0; l < chains2.size(); l++) {
+			std::string_view chain2 = chains2[l];
+			auto padded_size = std::max(chain1.length(), chain2.length()) + 2 * max_displacement;
+
+			parallel2[l] = pad(chain2.begin(), chain2.end(), padded_size, encoded2[0][l]);
+			antiparallel2[l] = pad(chain2.rbegin(), chain2.rend(), padded_size, encoded2[1][l]);
+			padded_length = std::max(padded_length, padded_size);
+		}
+
+		auto chain1_codes = pad(chain1.begin(), chain1.end(), padded_length, encoded1);
+		for (size_t l = 0; l < chains2.size(); l++) {
+			padded1[l] = chain1_codes.first(parallel2[l].size());
+		}
+
+		transpose(chain1_codes, padded2, chains2.size(), padded_length, orientation, codes1, codes2);
+		score_displacements_block(codes1.data(), codes2.data(), padded_length, padded1, padded2, chains2.size(), alignment, truncate, orientation, best);
+	}
 };
\ No newline at end of file
@@ -1,9 +1,11 @@
 #include <algorithm>
 #include <iostream>
+#include <numeric>
 #include <string>
 
 #include "flags.h"
 
+#include "common/ParallelFor.h"
 #include "common/PeptideSet.h"
 
 #include "scoring/ScoringEnginePotapov.h"
@@ -111,6 +113,13 @@ int main(int argc, char **argv) {
 
 	initial_set.read(input_path);
 
+	int threads = args.get<int>("threads", 0);
+	if (threads < 0) {
+		cerr << "--threads can not be negative\n";
+		return 1;
+	}
+	ThreadPool::configure_global(threads, false);
+
 	for (auto& p : initial_set) {
 		trimmed_set.push_back(p.remove_padding());
 	}
@@ -119,11 +128,18 @@ int main(int argc, char **argv) {
 
 	cout << "Initial scoring\n";
 
+	vector<int> rows(trimmed_set.size());
+	iota(rows.begin(), rows.end(), 0);
+	parallel_for(rows.begin(), rows.end(), [&](int i) {
+		for (int j = i; j < trimmed_set.size(); j++) {
+			initial_scores[i][j] = initial_scores[j][i] = sc.score(initial_set[i].sequence, initial_set[j].sequence);
+		}
+	});
+
 	for (int i = 0; i < trimmed_set.size(); i++) {
 		for (int j = i; j < trimmed_set.size(); j++) {
 			initial_pair_set.push_back(make_pair(i, j));
 			initial_pair_set.push_back(make_pair(j, i));
-			initial_scores[i][j] = initial_scores[j][i] = sc.score(initial_set[i].sequence, initial_set[j].sequence);
 		}
 	}
 
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "common/ParallelFor.h"
+
+#include "mcqd_para/BB_GreedyColorSort.h"
+
+// A quick local search for a large clique, run before the exact search so that the branch and bound starts with
+// a good lower bound instead of an empty clique. Every worker of the pool grows cliques greedily and, once a
+// clique can not grow any more, swaps one of its vertices for a vertex adjacent to all the others, with the
+// vertices just swapped out kept aside for a while so that the walk over cliques of the same size does not
+// cycle. A worker that has not improved its clique for a while starts over from a random vertex.
+// Works on any graph with getNumVertices() and isAdjacent(), in the vertex numbers the graph has when called.
+template<class GraphType>
+class CliqueLocalSearch
+{
+	typedef int VertexId;
+
+	const GraphType& graph;
+	size_t n;
+
+	// steps without a larger clique after which a worker starts over, and the least steps a swapped out vertex is kept out
+	static constexpr size_t restart_steps = 4096;
+	static constexpr size_t min_tabu_steps = 7;
+
+	struct Walk
+	{
+		const GraphType& graph;
+		size_t n;
+		std::mt19937_64 rng;
+		std::vector<VertexId> clique;
+		std::vector<char> inClique;
+		// the vertices of the clique every vertex outside it is not adjacent to
+		std::vector<unsigned> missing;
+		// a vertex swapped out of the clique may not come back before this step
+		std::vector<size_t> tabuUntil;
+		std::vector<VertexId> candidates;
+		size_t step = 0;
+
+		Walk(const GraphType& graph, std::seed_seq& seed) : graph(graph), n(graph.getNumVertices()), rng(seed),
+			inClique(n, 0), missing(n, 0), tabuUntil(n, 0) {}
+
+		void add(VertexId u)
+		{
+			inClique[u] = 1;
+			clique.push_back(u);
+			for (size_t v = 0; v < n; v++)
+			{
+				if (v != size_t(u) && !graph.isAdjacent(u, VertexId(v))) missing[v]++;
+			}
+		}
+
+		void remove(VertexId u)
+		{
+			inClique[u] = 0;
+			clique.erase(std::find(clique.begin(), clique.end(), u));
+			for (size_t v = 0; v < n; v++)
+			{
+				if (v != size_t(u) && !graph.isAdjacent(u, VertexId(v))) missing[v]--;
+			}
+		}
+
+		void clear()
+		{
+			while (!clique.empty()) remove(clique.back());
+		}
+
+		// a random allowed vertex outside the clique that misses exactly count of its vertices, or -1
+		VertexId pick(unsigned count)
+		{
+			candidates.clear();
+			for (size_t v = 0; v < n; v++)
+			{
+				if (!inClique[v] && missing[v] == count && tabuUntil[v] <= step) candidates.push_back(VertexId(v));
+			}
+			if (candidates.empty()) return -1;
+			return candidates[std::uniform_int_distribution<size_t>(0, candidates.size() - 1)(rng)];
+		}
+
+		// grows the clique or, failing that, swaps one of its vertices; false when neither is possible
+		bool move()
+		{
+			step++;
+			VertexId u = pick(0);
+			if (u >= 0)
+			{
+				add(u);
+				return true;
+			}
+
+			u = pick(1);
+			if (u < 0) return false;
+			VertexId w = *std::find_if(clique.begin(), clique.end(), [&](VertexId v) { return !graph.isAdjacent(u, v); });
+			remove(w);
+			add(u);
+			tabuUntil[w] = step + min_tabu_steps + std::uniform_int_distribution<size_t>(0, clique.size())(rng);
+			return true;
+		}
+	};
+
+public:
+	CliqueLocalSearch(const GraphType& graph) : graph(graph), n(graph.getNumVertices()) {}
+
+	// the largest clique found in the given seconds, and at least as large as known, which the first worker starts from;
+	// every worker draws from its own generator, seeded from seed and its index
+	BitstringSet run(double seconds, const BitstringSet& known, uint64_t seed, ThreadPool& pool = ThreadPool::global())
+	{
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(seconds);
+		std::vector<VertexId> best;
+		for (size_t v = 0; v < n && best.size() < known.size(); v++)
+		{
+			if (known[v]) best.push_back(VertexId(v));
+		}
+
+		// the clique of every worker, the largest one being picked by worker index rather than by which finished first
+		std::vector<std::vector<VertexId>> found(pool.size());
+
+		pool.run([&](unsigned worker)
+			{
+				std::seed_seq worker_seed{ uint32_t(seed), uint32_t(seed >> 32), uint32_t(worker) };
+				Walk walk(graph, worker_seed);
+				if (worker == 0)
+				{
+					for (auto v : best) walk.add(v);
+				}
+
+				std::vector<VertexId> own = walk.clique;
+				size_t last_improvement = 0;
+				while (std::chrono::steady_clock::now() < deadline)
+				{
+					if (walk.clique.empty() || !walk.move() || walk.step - last_improvement > restart_steps)
+					{
+						walk.clear();
+						walk.add(VertexId(std::uniform_int_distribution<size_t>(0, n - 1)(walk.rng)));
+						last_improvement = walk.step;
+					}
+					if (walk.clique.size() > own.size())
+					{
+						own = walk.clique;
+						last_improvement = walk.step;
+					}
+				}
+
+				found[worker] = std::move(own);
+			});
+
+		for (auto& own : found)
+		{
+			if (own.size() > best.size()) best = std::move(own);
+		}
+
+		BitstringSet clique;
+		clique.reserve(n);
+		for (auto v : best) clique.add(v);
+		return clique;
+	}
+};
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "mcqd_para/MaximumCliqueBase.h"
+#include "mcqd_para/BB_GreedyColorSort.h"
+
+// The dimer compatibility graph without its adjacency matrix. Each vertex is a pair of peptides, and two
+// vertices are adjacent exactly when none of the four peptide pairs across them interact, which also rules out
+// sharing a peptide. So one P x P bitset of non-interacting peptides and the peptides of every vertex describe
+// the graph, in O(P^2) bits instead of the O(V^2) of Graph<BitstringSet>.
+// Neighbourhoods are combined from the rows of the two peptides of a vertex whenever the search asks for them:
+// v = (c, d) is a neighbour of u = (a, b) if bits c and d are both set in row a & row b. Degrees and the neighbours
+// of a single vertex come from the vertices of every peptide in that row, so neither takes a pass over all vertices.
+class PeptidePairGraph
+{
+public:
+	typedef BitstringSet VertexSet;
+	typedef VertexSet::VertexId VertexId;
+
+	std::vector<int> degrees;
+	std::vector<int> mapping;
+
+private:
+	// bit q of row p is set when peptides p != q do not interact
+	std::vector<BitstringSet> nonInteracting;
+	// the peptides of every vertex, in the current vertex order
+	std::vector<std::pair<uint32_t, uint32_t>> peptides;
+	// bit d of pairRows[c] is set when (c, d), c <= d, is a vertex
+	std::vector<BitstringSet> pairRows;
+	// the vertices (c, d), c <= d, of every peptide c as (d, vertex), in the current vertex order
+	std::vector<std::vector<std::pair<uint32_t, VertexId>>> byPeptide;
+
+	static constexpr size_t res = sizeof(unsigned long) * 8;
+
+	static bool test(const std::vector<unsigned long>& bits, size_t index)
+	{
+		return (bits[index / res] >> (index % res)) & 1;
+	}
+
+	// the peptides that interact with neither peptide of u
+	void commonRow(VertexId u, std::vector<unsigned long>& row) const
+	{
+		auto& a = nonInteracting[peptides[u].first];
+		auto& b = nonInteracting[peptides[u].second];
+		row.resize(a.numBlocks());
+		for (size_t k = 0; k < row.size(); k++) row[k] = a.getBlock(k) & b.getBlock(k);
+	}
+
+	// calls f(index) for every set bit of bits
+	template<class F>
+	static void forEachBit(const std::vector<unsigned long>& bits, F f)
+	{
+		for (size_t block = 0; block < bits.size(); block++)
+		{
+			for (unsigned long left = bits[block]; left; left &= left - 1) f(block * res + countTrailing0(left));
+		}
+	}
+
+	void indexByPeptide()
+	{
+		for (auto& vertices : byPeptide) vertices.clear();
+		for (size_t v = 0; v < peptides.size(); v++)
+		{
+			auto [c, d] = std::minmax(peptides[v].first, peptides[v].second);
+			byPeptide[c].push_back({ d, VertexId(v) });
+		}
+	}
+
+	// keeps the vertices of "vertices" for which keep(adjacent to u, vertex) holds
+	template<class Keep>
+	void filter(VertexId u, VertexSet& vertices, Keep keep) const
+	{
+		static thread_local std::vector<unsigned long> row;
+		commonRow(u, row);
+		for (size_t block = 0; block < vertices.numBlocks(); block++)
+		{
+			unsigned long bits = vertices.getBlock(block), left = bits;
+			while (left)
+			{
+				auto k = countTrailing0(left);
+				left &= left - 1;
+				VertexId v = VertexId(block * res + k);
+				bool adjacent = test(row, peptides[v].first) && test(row, peptides[v].second);
+				if (!keep(adjacent, v)) bits &= ~(1ul << k);
+			}
+			vertices.setBlock(block, bits);
+		}
+		vertices.recount();
+	}
+
+public:
+	// nonInteracting(p, q) tells whether the distinct peptides p and q do not interact, forEach(count, f) must call
+	// f(k) for every k < count, in any order and possibly in parallel
+	template<class NonInteracting, class ForEach>
+	void init(size_t peptideCount, const std::vector<std::pair<int, int>>& vertices, NonInteracting nonInteractingPair, ForEach forEach)
+	{
+		nonInteracting.clear();
+		nonInteracting.resize(peptideCount);
+		forEach(peptideCount, [&](size_t p) {
+			nonInteracting[p].resize(peptideCount);
+			for (size_t q = 0; q < peptideCount; q++)
+			{
+				if (q != p && nonInteractingPair(p, q)) nonInteracting[p][q] = true;
+			}
+		});
+
+		peptides.resize(vertices.size());
+		for (size_t v = 0; v < vertices.size(); v++) peptides[v] = { uint32_t(vertices[v].first), uint32_t(vertices[v].second) };
+		mapping.clear();
+
+		pairRows.assign(peptideCount, BitstringSet());
+		for (auto& row : pairRows) row.resize(peptideCount);
+		for (auto [p, q] : peptides) pairRows[std::min(p, q)][std::max(p, q)] = true;
+		byPeptide.assign(peptideCount, {});
+		indexByPeptide();
+
+		// the neighbours of u are the vertices (c, d) with c and d in the common row of u, so they are counted
+		// a row of pairRows at a time, for every c in the common row
+		size_t n = getNumVertices();
+		degrees.assign(n, 0);
+		forEach(n, [&](size_t u) {
+			static thread_local std::vector<unsigned long> row;
+			commonRow(VertexId(u), row);
+			int degree = 0;
+			forEachBit(row, [&](size_t c) {
+				for (size_t k = 0; k < row.size(); k++) degree += countOnes(pairRows[c].getBlock(k) & row[k]);
+			});
+			degrees[u] = degree;
+		});
+	}
+
+	size_t getNumVertices() const { return peptides.size(); }
+
+	// bytes the bitsets and the vertex index take, compare with 2 * V^2 / 8 for Graph<BitstringSet>
+	size_t memoryUsage() const
+	{
+		return 2 * nonInteracting.size() * ((nonInteracting.size() + res - 1) / res) * sizeof(unsigned long) +
+			peptides.size() * (sizeof(peptides[0]) + sizeof(byPeptide[0][0]));
+	}
+
+	// calls f(v) for every neighbour v of u, in no particular order
+	template<class F>
+	void forEachNeighbour(VertexId u, F f) const
+	{
+		std::vector<unsigned long> row;
+		commonRow(u, row);
+		forEachBit(row, [&](size_t c) {
+			for (auto [d, v] : byPeptide[c])
+			{
+				if (test(row, d)) f(v);
+			}
+		});
+	}
+
+	void intersectWithNeighbours(VertexId u, const VertexSet& vertices, VertexSet& result) const
+	{
+		result = vertices;
+		filter(u, result, [](bool adjacent, VertexId) { return adjacent; });
+	}
+
+	// removes u and all its neighbours from "vertices"
+	void intersectWithNonNeighbours(VertexId u, VertexSet& vertices) const
+	{
+		filter(u, vertices, [u](bool adjacent, VertexId v) { return !adjacent && v != u; });
+	}
+
+	bool isAdjacent(VertexId u, VertexId v) const
+	{
+		auto& a = nonInteracting[peptides[u].first];
+		auto& b = nonInteracting[peptides[u].second];
+		auto [c, d] = peptides[v];
+		return a[c] && a[d] && b[c] && b[d];
+	}
+
+	// renumbers the vertices, vertex i becoming the former order[i]
+	template<class Vec>
+	void orderVertices(const Vec& order)
+	{
+		size_t n = getNumVertices();
+		if (order.size() != n)
+			throw "Invalid size vector in orderVertices";
+
+		if (mapping.size() == 0)
+		{
+			mapping.resize(n);
+			for (size_t i = 0; i < n; ++i) mapping[i] = i;
+		}
+
+		auto oldPeptides = peptides;
+		auto oldMapping = mapping;
+		auto oldDegrees = degrees;
+		for (size_t i = 0; i < n; ++i)
+		{
+			peptides[i] = oldPeptides[order[i]];
+			mapping[i] = oldMapping[order[i]];
+			degrees[i] = oldDegrees[order[i]];
+		}
+		indexByPeptide();
+	}
+
+	// in-place remapping of a vertex set back to the original vertex numbers
+	void remap(VertexSet& v)
+	{
+		if (mapping.size() == 0 || v.size() == 0) return;
+
+		VertexSet rv;
+		rv.reserve(mapping.size());
+		for (size_t i = 0; rv.size() < v.size(); ++i)
+		{
+			if (v[i]) rv.add(mapping[i]);
+		}
+		std::swap(rv, v);
+	}
+};
+REGISTER_CLASS_NAME(PeptidePairGraph, "implicit peptide pair graph");
@@ -86,7 +86,8 @@ void dump_dimacs(std::vector<std::vector<char>>& conn, const char *fname)
 	fclose(fout);
 }
 
-void print_clique(const string out_name, const BitstringSet& clique, Graph<BitstringSet>& graph, std::string_view cmdline, bool overwrite = true)
+template<class GraphType>
+void print_clique(const string out_name, const BitstringSet& clique, GraphType& graph, std::string_view cmdline, bool overwrite = true)
 {
 	stringstream ss;
 	bool comma = false;
@@ -155,7 +156,16 @@ float** allocate_matrix_pointers(float* data, int n)
 
 float **read_scores_binary(std::string score_file, std::string fasta_name)
 {
-	static InteractionMatrix im = InteractionMatrix::from_binary<score_t>(score_file);
+	auto header = read_file_header(score_file);
+	auto flags = header.flags;
+	// a query set scored against a library (fastscore --against) has no interaction graph to search
+	if (header.m != header.n)
+	{
+		fprintf(stderr, "%s holds a %llu x %llu matrix, the solver needs a square one\n", score_file.c_str(), (unsigned long long)header.n, (unsigned long long)header.m);
+		exit(1);
+	}
+	static InteractionMatrix im = (flags & MatrixFlags::sparse) ? InteractionMatrix::from_sparse(score_file) :
+		(flags & MatrixFlags::records) ? InteractionMatrix::from_records(score_file) : InteractionMatrix::from_binary<score_t>(score_file);
 	float* score_storage = im[0];
 
 	size_t n_peptides = im.size();
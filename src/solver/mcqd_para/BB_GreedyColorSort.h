@@ -49,6 +49,11 @@ public:
     void clear() {BitSet::clear(); countCache = 0;};
     using BitSet::nextSetBit;
     using BitSet::operator~;
+    using BitSet::resolution;
+    using BitSet::numBlocks;
+    using BitSet::getBlock;
+    using BitSet::setBlock;
+    using BitSet::transposeBlock;
     
     void operator&=(const BitSet& other) {BitSet::operator&= (other);}
     void operator&=(const BitstringSet& other) {BitSet::operator&= (other);}
@@ -146,7 +151,7 @@ public:
         while (Ubb.size() > 0) {
             while (Qbb.size() > 0) {
                 auto v = Qbb.nextSetBit();
-                Qbb &= graph->invAdjacencyMatrix[v];
+                graph->intersectWithNonNeighbours(v, Qbb);
                 Qbb.recount();
                 Ubb.remove(v);
                 if (k >= kMin) {
@@ -309,6 +309,23 @@ public:
         return size();
     }
     
+    // whole blocks of resolution() bits, bit k of block b holding element b * resolution() + k
+    size_t numBlocks() const {return data.size();}
+    unsigned long getBlock(size_t b) const {return data[b].to_ulong();}
+    void setBlock(size_t b, unsigned long bits) {data[b] = bits;}
+    
+    // transposes a square of res x res bits in place, bit c of rows[r] becoming bit r of rows[c]
+    static void transposeBlock(unsigned long* rows) {
+        unsigned long mask = ~0ul >> (res / 2);
+        for (unsigned int j = res / 2; j != 0; j >>= 1, mask ^= mask << j) {
+            for (unsigned int k = 0; k < res; k = ((k | j) + 1) & ~j) {
+                unsigned long t = ((rows[k] >> j) ^ rows[k | j]) & mask;
+                rows[k | j] ^= t;
+                rows[k] ^= t << j;
+            }
+        }
+    }
+    
     std::string to_string() const {
         std::ostringstream s;
         for (size_t i = 0; i < size(); ++i)
@@ -21,6 +21,7 @@
 
 
 #include "KillTimer.h"
+#include "BitSet.h"
 #include <vector>
 #include <algorithm>
 #include <iostream>
@@ -264,12 +265,87 @@ public:
         mapping.clear();
     }
     
+    // Builds both adjacency matrices and the degrees straight from an edge function, a block of
+    // VectorSetRepresentation::resolution() bits at a time, without an intermediate matrix.
+    // lowerBlock(i, b) returns the neighbours of vertex i among the vertices of block b as bits; only those below i
+    // are used, the upper triangle is filled in with transposed blocks. forEach(count, f) must call f(k) for every
+    // k < count, in any order and possibly in parallel.
+    template<class LowerBlock, class ForEach>
+    void initBlocks(size_t n, LowerBlock lowerBlock, ForEach forEach) {
+        const size_t res = VectorSetRepresentation::resolution();
+        const size_t blocks = (n + res - 1) / res;
+        adjacencyMatrix.clear();
+        adjacencyMatrix.resize(n);
+        invAdjacencyMatrix.clear();
+        invAdjacencyMatrix.resize(n);
+        degrees.assign(n, 0);
+        mapping.clear();
+        
+        forEach(n, [&](size_t i) {
+            adjacencyMatrix[i].resize(n);
+            invAdjacencyMatrix[i].resize(n);
+            for (size_t b = 0; b <= i / res; ++b) {
+                unsigned long bits = lowerBlock(i, b);
+                if (b == i / res) bits &= (1ul << (i % res)) - 1;
+                adjacencyMatrix[i].setBlock(b, bits);
+            }
+        });
+        
+        // block (R, C) above the diagonal is the transpose of block (C, R), which only its own block row writes;
+        // on the diagonal, the transposed lower triangle is added to the block
+        forEach(blocks, [&](size_t R) {
+            std::vector<unsigned long> block(res);
+            for (size_t C = R; C < blocks; ++C) {
+                for (size_t r = 0; r < res; ++r)
+                    block[r] = C * res + r < n ? adjacencyMatrix[C * res + r].getBlock(R) : 0;
+                VectorSetRepresentation::transposeBlock(block.data());
+                for (size_t r = 0; r < res && R * res + r < n; ++r) {
+                    auto& row = adjacencyMatrix[R * res + r];
+                    row.setBlock(C, row.getBlock(C) | block[r]);
+                }
+            }
+        });
+        
+        // the inverse has no self loops either, see orderVertices
+        forEach(n, [&](size_t i) {
+            int degree = 0;
+            for (size_t b = 0; b < blocks; ++b) {
+                unsigned long bits = adjacencyMatrix[i].getBlock(b);
+                unsigned long used = (b + 1) * res <= n ? ~0ul : (1ul << (n - b * res)) - 1;
+                if (b == i / res) used &= ~(1ul << (i % res));
+                degree += std::bitset<sizeof(bits) * 8>(bits).count();
+                invAdjacencyMatrix[i].setBlock(b, ~bits & used);
+            }
+            degrees[i] = degree;
+        });
+    }
+    
     // perform intersection, "result" keeps the ordering of the set "vertices"
     void intersectWithNeighbours(VertexId p, const VertexSet& vertices, VertexSet& result) const {
         // global function intersectWithAdjecency(VectorSetRepresentation, VectorSetRepresentation, VectorSetRepresentation) must be specified
         intersectWithAdjecency(vertices, adjacencyMatrix[p], result);
     }
     
+    // removes p and all its neighbours from "vertices"
+    void intersectWithNonNeighbours(VertexId p, VertexSet& vertices) const {
+        vertices &= invAdjacencyMatrix[p];
+    }
+    
+    bool isAdjacent(VertexId p, VertexId q) const {
+        return adjacencyMatrix[p][q];
+    }
+
+    // calls f(q) for every neighbour q of p, in increasing order
+    template<class F>
+    void forEachNeighbour(VertexId p, F f) const {
+        const size_t res = VertexSet::resolution();
+        const auto& row = adjacencyMatrix[p];
+        for (size_t b = 0; b < row.numBlocks(); ++b) {
+            for (unsigned long bits = row.getBlock(b); bits; bits &= bits - 1)
+                f(VertexId(b * res + countTrailing0(bits)));
+        }
+    }
+    
     bool intersectionExists(VertexId p, const VertexSet& vertices) const {
         size_t n = vertices.size();
         for (size_t i = 0; i < n; ++i) {
@@ -24,6 +24,7 @@
 **/
 
 #include "MaximumCliqueBase.h"
+#include <functional>
 
 
 template<class ColorSort>
@@ -73,13 +74,20 @@ struct BBMcrSort : public ColorSort {
         //  it is possible this should be done on every step of the following while loop, taking only
         //  the neighbourhood of the observed vertex into an account (but probably not)
         for (size_t i = 0; i < n; ++i) 
-            for (size_t j = 0; j < n; ++j) 
-                if (this->graph->adjacencyMatrix[i][j] == true)
-                    r[i].exDegree += r[j].degree;
+            this->graph->forEachNeighbour(i, [&](VertexId j) { r[i].exDegree += r[j].degree; });
                     
         // sort by degree (descending), stable mode (respect relative order of the vertices with the same degree)
         std::stable_sort(r.begin(), r.end(), [](const Vertex& a, const Vertex& b) {return (a.degree > b.degree);});
         TRACEVAR(r, TRACE_MASK_INITIAL, 2); 
+
+        // where every vertex is in r, -1 once it has been taken out; the neighbours of a vertex are visited through
+        // the graph instead of testing every vertex left in r against it
+        std::vector<int> position(n);
+        std::vector<size_t> neighbourPositions;
+        auto place = [&](size_t from, size_t to) {
+            for (size_t i = from; i < to; ++i) position[r[i].index] = int(i);
+        };
+        place(0, n);
                 
         // index in vertices
         size_t vi = n-1;
@@ -100,6 +108,7 @@ struct BBMcrSort : public ColorSort {
             if (rMinIndex < r.size()-1) {
                 // sort by ex-deg (descending - max is first)
                 std::stable_sort(r.begin()+rMinIndex, r.end(), [](const Vertex& a, const Vertex& b){return (a.exDegree > b.exDegree);});
+                place(rMinIndex, r.size());
             }
             
             // vertex with min ex-deg in rMin goes into the ordered set of vertices (filled from the back towards the front)
@@ -107,16 +116,23 @@ struct BBMcrSort : public ColorSort {
             order[vi] = p.index;
             --vi;
             
-            // decrease the degree of remaining vertices that are adjacent to p
-            auto& adjacent = this->graph->adjacencyMatrix[p.index];
+            // decrease the degree of remaining vertices that are adjacent to p, from the back of r to the front; a
+            // vertex sorted back only moves the ones behind it, so those still to come stay where they were found
+            auto pIndex = p.index;
+            position[pIndex] = -1;
             r.pop_back();
             size_t rs = r.size();
-            for (size_t i = rs; i > 0; --i) {
-                if (adjacent[r[i-1].index] == true) {
-                    auto rid = --r[i-1].degree;
-                    // sort the modified vertex immediately
-                    for (size_t j = i; (j < rs) && (rid  < r[j].degree); ++j) 
-                        swap(r[j-1], r[j]);
+            neighbourPositions.clear();
+            this->graph->forEachNeighbour(pIndex, [&](VertexId v) {
+                if (position[v] >= 0) neighbourPositions.push_back(position[v]);
+            });
+            std::sort(neighbourPositions.begin(), neighbourPositions.end(), std::greater<size_t>());
+            for (size_t i : neighbourPositions) {
+                auto rid = --r[i].degree;
+                // sort the modified vertex immediately
+                for (size_t j = i+1; (j < rs) && (rid  < r[j].degree); ++j) {
+                    swap(r[j-1], r[j]);
+                    place(j-1, j+1);
                 }
             }
         }
@@ -132,7 +132,8 @@ public:
                             std::lock_guard<std::mutex> lk(parent->mutexJobs); 
                             TRACEVAR(parent->activeJobs, TRACE_MASK_THREAD, 2);
                             // if there is no queued jobs then wait; if there is also no active jobs (that would be adding to the queue) then quit
-                            if (parent->jobs.size() == 0) {
+                            // after a timeout the queued jobs are left for upperBound()
+                            if (parent->jobs.size() == 0 || parent->killTimer.timedOut) {
                                 /*
                                 // when dynamic tree splitting is used, try the following:
                                 if (parent->activeJobs == 0)
@@ -173,10 +174,13 @@ public:
                             ++jobsDone;
                         }
                         TRACE("threadFunc: job completed", TRACE_MASK_THREAD, 1);
+                        // a job cut short by the timeout still bounds the cliques in the part it did not explore
+                        unsigned int bound = parent->killTimer.timedOut ? remainingBound(*this, job, 1) : 0;
                         // deactivate the completed job
                         {
                             std::lock_guard<std::mutex> lk(parent->mutexJobs);
                             --parent->activeJobs;
+                            parent->interruptedMax = std::max(parent->interruptedMax, bound);
                         }
                     }
                 } // timer scope end           
@@ -262,6 +266,15 @@ public:
     };
 
     
+    // the largest clique in what is left of a job, plus inProgress for a vertex whose subtree was cut short;
+    // coloring the vertices left anew gives a much tighter bound than estimatedMax, which is often inherited from a parent job
+    static unsigned int remainingBound(Sorter& sorter, const Job& job, unsigned int inProgress) {
+        NumberedSet numbers;
+        sorter.numberSort(job.c, job.vertices, numbers);
+        unsigned int colors = numbers.size() > 0 ? sorter.topNumber(numbers) : 0;
+        return std::min(job.estimatedMax, (unsigned int)job.c.size() + inProgress + colors);
+    }
+
 protected:
     using InitialSorter::initialSort;
         
@@ -269,6 +282,7 @@ protected:
     Graph* graph;
     VertexId n;                         // number of vertices
     unsigned int maxSize;               // size of max clique
+    unsigned int interruptedMax;        // the largest clique the jobs left unfinished by a timeout could still hold
     unsigned int numThreads;            // stores the number of threads used in the last search (where this number a parameter to the function)
     VertexSet maxClique;
     std::deque<Job> jobs;
@@ -281,6 +295,7 @@ protected:
     KillTimer1 killTimer;
     
 public:
+    // a clique of the input graph, in its own vertex numbers, that the search starts from and only has to beat
     VertexSet knownC;
 
     ParallelMaximumCliqueProblem(Graph& graph) : graph(&graph), n(graph.getNumVertices()), maxSize(0) {}
@@ -359,9 +374,10 @@ public:
         }*/
     }
     
-    // run the search for max clique
-    void search(unsigned int numThreads, unsigned int numJobs, std::vector<int>& affinities) {
-        killTimer.start(10.0 * 24 * 60 * 60 ); //10 days :)
+    // run the search for max clique, for at most timeLimit seconds
+    void search(unsigned int numThreads, unsigned int numJobs, std::vector<int>& affinities, double timeLimit = 10.0 * 24 * 60 * 60) {
+        killTimer.start(timeLimit); //10 days by default :)
+        interruptedMax = 0;
         ScopeTimer t(timer);
         VertexSet c; // clique
         VertexSet p; // working set of vertices
@@ -384,6 +400,19 @@ public:
                 saveSolution(c);
                 c.clear();
             }
+
+            // the initial sort renumbered the vertices, graph->mapping leads back to the input numbers
+            if (knownC.size() > 0) {
+                auto& mapping = graph->mapping;
+                if (mapping.size() == 0) {
+                    c = knownC;
+                } else {
+                    for (VertexId i = 0; i < n; i++)
+                        if (knownC[mapping[i]]) c.add(i);
+                }
+                saveSolution(c);
+                c.clear();
+            }
         }
         
         if (numbers.size() == 0) {
@@ -420,11 +449,16 @@ public:
             TRACE("Thread joined to main thread", TRACE_MASK_THREAD, 1);
         }
         killTimer.cancel();
+        for (auto& job : jobs)
+            interruptedMax = std::max(interruptedMax, remainingBound(*this, job, 0));
         jobs.clear();
         TRACE("search: end", TRACE_MASK_THREAD, 1)
     }
     
     bool wasSearchInterrupted() const {return killTimer.timedOut;}
+
+    // no clique is larger than this; when it equals getClique().size(), the clique is proven maximal even if the search was interrupted
+    unsigned int upperBound() const {return wasSearchInterrupted() ? std::max(maxSize, interruptedMax) : maxSize;}
     
     void debug() {
         std::cout << "Parallel Maximum Clique problem DEBUG:\n";
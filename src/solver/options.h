@@ -22,6 +22,13 @@ namespace options
 			{"out-name", required_argument, nullptr, 0},
 			{"fasta-name", required_argument, nullptr, 0 },
 			{"initial-set", required_argument, nullptr, 0 },
+			{"threads", required_argument, nullptr, 0 },
+			{"implicit-graph", no_argument, nullptr, 0 },
+			{"sweep", required_argument, nullptr, 0 },
+			{"delta", required_argument, nullptr, 0 },
+			{"time-limit", required_argument, nullptr, 0 },
+			{"warm-start", required_argument, nullptr, 0 },
+			{"seed", required_argument, nullptr, 0 },
 	};
 	map<string, string> opt_map;
 	void usage(char** argv)
@@ -1,13 +1,21 @@
 #include <algorithm>
+#include <chrono>
 #include <cstring>
 #include <ctime>
+#include <fstream>
 #include <iostream>
+#include <numeric>
 #include <sstream>
 #include <thread>
+#include <tuple>
+
+#include "common/ParallelFor.h"
 
 #include "common.h"
 #include "options.h"
 #include "ioutil.h"
+#include "PeptidePairGraph.h"
+#include "LocalSearch.h"
 
 #include "mcqd_para/MaximumCliqueBase.h"
 #include "mcqd_para/ParallelMaximumClique.h"
@@ -23,16 +31,21 @@ string fname, initial_set_fname;
 string out_name, fasta_name;
 
 int n_peptides = 0;
+unsigned n_threads = 0;
+// seconds each clique search may take, 0 for no limit
+double time_limit = 0;
+// seconds of local search before each clique search, 0 for none
+double warm_start = 0;
+uint64_t seed = 0;
 float **score;
 
 map<string, int> peptide_id;
 vector<string> reverse_id;
 
 vector<pair<int, int> > vertices, initial_set;
-vector<int> degrees;
-vector<vector<char> > conn;
 
-Graph<BitstringSet> graph;
+// above this size of the two adjacency bitsets, the graph is kept implicit, see PeptidePairGraph
+constexpr size_t max_bitset_graph_bytes = size_t(8) << 30;
 
 int get_id(string peptide)
 {
@@ -66,16 +79,20 @@ bool will_interact_with_initial(pair<int, int> potential_pair)
 }
 
 int max_count = 0;
+string cmdline;
+
+void set_cmdline(int argc, char** argv) {
+	cmdline = "#";
+	for (int i = 0; i < argc; i++) {
+		cmdline += argv[i] + " "s;
+	}
+	cmdline.pop_back();
+}
+
+template<class GraphType>
 struct ProgressReporter
 {
-	static string cmdline;
-	static void set_cmdline(int argc, char** argv) {
-		cmdline = "#";
-		for (int i = 0; i < argc; i++) {
-			cmdline += argv[i] + " "s;
-		}
-		cmdline.pop_back();
-	}
+	static GraphType* graph;
 
 	void operator()(const BitstringSet& clique) {
 		bool overwrite = false;
@@ -84,10 +101,237 @@ struct ProgressReporter
 			max_count = clique.size();
 			overwrite = true;
 		}
-		print_clique(out_name.c_str(), clique, graph, cmdline, overwrite);
+		print_clique(out_name.c_str(), clique, *graph, cmdline, overwrite);
 	};
 };
-std::string ProgressReporter::cmdline;
+template<class GraphType>
+GraphType* ProgressReporter<GraphType>::graph = nullptr;
+
+struct SearchResult
+{
+	BitstringSet clique;
+	// whether the search finished or otherwise proved that no larger set exists
+	bool optimal = false;
+	// the most pairs any orthogonal set can have, those of the initial set included
+	size_t upper_bound = 0;
+};
+
+// the largest orthogonal set among the vertices, or the largest one found within the time limit; the pairs file ends
+// with a line telling which of the two it is. known, a clique of the graph, only seeds the lower bound: the result is
+// at least as large, but need not contain any of it
+template<class GraphType>
+SearchResult search(GraphType& graph, const BitstringSet& known)
+{
+	ProgressReporter<GraphType>::graph = &graph;
+
+	ParallelMaximumCliqueProblem<
+            int,                        // vertex ID
+            BitstringSet,               // vertex set
+            GraphType,                  // graph
+            BBGreedyColorSort<GraphType>,        // color sort
+            BBMcrSort ,       // initial sort
+            ProgressReporter<GraphType>  //user callback
+	> problem(graph);
+	problem.knownC = known;
+
+	if (warm_start > 0)
+	{
+		auto local_start = chrono::steady_clock::now();
+		problem.knownC = CliqueLocalSearch<GraphType>(graph).run(warm_start, known, seed);
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - local_start).count();
+		cerr << "Local search found " << problem.knownC.size() + initial_set.size() << " pairs in " << seconds << "s\n";
+	}
+
+    int n_jobs = 2*n_threads;
+    std::vector<int> affinities;
+    printf("Running on %d threads, %d jobs\n", n_threads, n_jobs);
+
+    if (time_limit > 0) problem.search(n_threads, n_jobs, affinities, time_limit);
+    else problem.search(n_threads, n_jobs, affinities);
+    problem.outputStatistics(false); std::cout << "\n";
+    std::cout << "Thread efficiency = " << std::setprecision(3) << problem.workerEfficiency() << "\n\n";
+
+	BitstringSet clique = problem.getClique();
+	graph.remap(clique);
+	size_t bound = problem.upperBound();
+	SearchResult result{ clique, bound <= clique.size(), bound + initial_set.size() };
+
+	stringstream status;
+	if (result.optimal) status << "# optimal\n";
+	else status << "# time limit reached, not proven optimal, at most " << result.upper_bound << " pairs\n";
+	printf("%s", status.str().c_str());
+	FILE* fout = fopen(out_name.c_str(), "a");
+	fprintf(fout, "%s", status.str().c_str());
+	fclose(fout);
+
+	return result;
+}
+
+void find_vertices()
+{
+	vertices.clear();
+	if(search_homodimers)
+	{
+		for(int i=0;i<n_peptides;i++)
+		{
+			if(score[i][i]<=c1 && !will_interact_with_initial(make_pair(i, i))) vertices.push_back(make_pair(i, i));
+		}
+	}
+	if(search_heterodimers)
+	{
+		for(int i=0;i<n_peptides;i++)
+		{
+			for(int j=i+1;j<n_peptides;j++)
+			{
+				if(score[i][j]<=c1 &&
+				   score[i][i] >= c2 &&
+				   score[j][j] >= c2 && !will_interact_with_initial(make_pair(i, j)))
+					vertices.push_back(make_pair(i, j));
+			}
+		}
+	}
+}
+
+auto for_each_index = [](size_t count, auto f)
+{
+	vector<size_t> indices(count);
+	iota(indices.begin(), indices.end(), 0);
+	parallel_for(indices.begin(), indices.end(), f);
+};
+
+// the order find_vertices() produces the vertices in, homodimers first
+bool vertex_order(const pair<int, int>& a, const pair<int, int>& b)
+{
+	return make_tuple(a.first != a.second, a.first, a.second) < make_tuple(b.first != b.second, b.first, b.second);
+}
+
+// builds the graph on the current vertices and searches it, m is set to its number of edges
+SearchResult solve(const BitstringSet& known, size_t& m)
+{
+	size_t n = vertices.size();
+	m = 0;
+
+	// two vertices are adjacent when their pairs do not interact
+	const size_t res = BitstringSet::resolution();
+	size_t bitset_graph_bytes = 2 * n * ((n + res - 1) / res) * sizeof(unsigned long);
+	if (options::get("implicit-graph", false) || bitset_graph_bytes > max_bitset_graph_bytes)
+	{
+		PeptidePairGraph graph;
+		graph.init(n_peptides, vertices, [&](size_t p, size_t q) { return score[p][q] >= c2; }, for_each_index);
+		cerr << "Keeping the graph implicit in " << (graph.memoryUsage() >> 10) << " kB instead of " << (bitset_graph_bytes >> 10) << " kB of adjacency bitsets\n";
+
+		for (auto degree : graph.degrees) m += degree;
+		m /= 2;
+		return search(graph, known);
+	}
+	else
+	{
+		// the graph is built straight into its bitsets
+		auto lower_block = [&](size_t i, size_t b)
+		{
+			unsigned long bits = 0;
+			for (size_t j = b * res; j < min((b + 1) * res, i); j++)
+			{
+				if (!will_interact(vertices[i], vertices[j])) bits |= 1ul << (j - b * res);
+			}
+			return bits;
+		};
+		Graph<BitstringSet> graph;
+		graph.initBlocks(n, lower_block, for_each_index);
+
+		for (auto degree : graph.degrees) m += degree;
+		m /= 2;
+		return search(graph, known);
+	}
+}
+
+// Searches every binding cutoff of the sweep, with the nonbinding cutoff delta above it, and writes the set
+// found at each to OUT.<k>.pairs and the sizes to OUT.sweep.csv.
+// The scores are only read once, and the pairs that bind at the loosest cutoff are sorted by score, so that
+// each cutoff only looks at the ones below it. Every search starts from what is left of the previous set
+// under the new cutoffs, so it only has to prove that set optimal or improve on it.
+void sweep(float start, float stop, float step, float delta)
+{
+	size_t cutoff_count = size_t(floor((stop - start) / step + 1e-4f)) + 1;
+	float loosest = max(start, start + (cutoff_count - 1) * step);
+
+	vector<pair<float, pair<int, int>>> binding;
+	for (int i = 0; i < n_peptides; i++)
+	{
+		for (int j = search_homodimers ? i : i + 1; j < (search_heterodimers ? n_peptides : i + 1); j++)
+		{
+			if (score[i][j] <= loosest) binding.push_back({ score[i][j], { i, j } });
+		}
+	}
+	sort(binding.begin(), binding.end());
+
+	string out_basename = basename(out_name), base_cmdline = cmdline;
+	ofstream csv_file(out_basename + ".sweep.csv");
+	// through a plain ostream, the floats do not also match the operator<< of BitSet
+	ostream& csv = csv_file;
+	csv << "binding_cutoff,nonbinding_cutoff,vertices,edges,set_size,optimal,upper_bound,seconds\n";
+
+	vector<pair<int, int>> previous_set;
+	for (size_t k = 0; k < cutoff_count; k++)
+	{
+		auto cutoff_start = chrono::steady_clock::now();
+		c1 = start + k * step;
+		c2 = c1 + delta;
+		cerr << "Sweep " << k + 1 << "/" << cutoff_count << ": binding cutoff " << c1 << ", nonbinding cutoff " << c2 << "\n";
+
+		// the same vertices, in the same order, as a run with just these cutoffs
+		vertices.clear();
+		for (auto it = binding.begin(); it != binding.end() && it->first <= c1; ++it)
+		{
+			auto [i, j] = it->second;
+			if ((i == j || (score[i][i] >= c2 && score[j][j] >= c2)) && !will_interact_with_initial(it->second))
+				vertices.push_back(it->second);
+		}
+		sort(vertices.begin(), vertices.end(), vertex_order);
+
+		size_t m = 0, set_size = initial_set.size(), upper_bound = set_size;
+		bool optimal = true;
+		vector<pair<int, int>> current_set;
+		if (!vertices.empty())
+		{
+			// the pairs of the previous set that still bind and do not interact with each other
+			BitstringSet known;
+			known.reserve(vertices.size());
+			vector<pair<int, int>> kept;
+			for (auto& p : previous_set)
+			{
+				auto it = lower_bound(vertices.begin(), vertices.end(), p, vertex_order);
+				if (it == vertices.end() || *it != p) continue;
+				if (any_of(kept.begin(), kept.end(), [&](auto& q) { return will_interact(p, q); })) continue;
+				kept.push_back(p);
+				known.add(int(it - vertices.begin()));
+			}
+
+			out_name = out_basename + "." + to_string(k) + ".pairs";
+			stringstream cutoffs;
+			cutoffs << " --binding-cutoff=" << c1 << " --nonbinding-cutoff=" << c2;
+			cmdline = base_cmdline + cutoffs.str();
+			max_count = 0;
+
+			SearchResult result = solve(known, m);
+			for (size_t i = 0; i < vertices.size(); i++)
+			{
+				if (result.clique[i]) current_set.push_back(vertices[i]);
+			}
+			set_size = current_set.size() + initial_set.size();
+			optimal = result.optimal;
+			upper_bound = result.upper_bound;
+		}
+		else
+		{
+			cerr << "Orthogonal set impossible with these cutoffs\n";
+		}
+		previous_set = current_set;
+
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - cutoff_start).count();
+		csv << c1 << "," << c2 << "," << vertices.size() << "," << m << "," << set_size << "," << optimal << "," << upper_bound << "," << seconds << endl;
+	}
+}
 
 int main(int argc, char** argv)
 {
@@ -115,7 +359,7 @@ int main(int argc, char** argv)
 
 		string default_output_name = basename(fname) + ".pairs";
 		out_name = options::get("out-name", default_output_name);
-		ProgressReporter::set_cmdline(argc, argv);
+		set_cmdline(argc, argv);
 
 		if(!(search_homodimers || search_heterodimers))
 		{
@@ -123,34 +367,62 @@ int main(int argc, char** argv)
 			exit(0);
 		}
 		initial_set_fname = options::get("initial-set", string(""));
+		int threads_arg = options::get("threads", 0);
+		if (threads_arg < 0)
+		{
+			fprintf(stderr, "--threads can not be negative\n");
+			exit(1);
+		}
+		n_threads = threads_arg;
+		time_limit = options::get("time-limit", 0.);
+		warm_start = options::get("warm-start", 0.);
+		seed = options::get("seed", uint64_t(0));
 	}
 
-	score = read_scores(fname, fasta_name);
-	cerr<<n_peptides<<" peptides\n";
-
-	read_initial_set();
+	ThreadPool::configure_global(n_threads, false);
+	n_threads = ThreadPool::global().size();
 
-	if(search_homodimers)
+	string sweep_range = options::get("sweep", string(""));
+	float sweep_start = 0, sweep_stop = 0, sweep_step = 0, sweep_delta = options::get("delta", 1.f);
+	if (!sweep_range.empty())
 	{
-		for(int i=0;i<n_peptides;i++)
+		if (sscanf(sweep_range.c_str(), "%f:%f:%f", &sweep_start, &sweep_stop, &sweep_step) != 3 || sweep_step == 0 ||
+			(sweep_stop - sweep_start) / sweep_step < 0)
 		{
-			if(score[i][i]<=c1 && !will_interact_with_initial(make_pair(i, i))) vertices.push_back(make_pair(i, i));
+			fprintf(stderr, "--sweep takes START:STOP:STEP, with STEP going from START towards STOP\n");
+			exit(1);
 		}
+		// the loosest cutoffs of the sweep decide what has to be in a sparse file
+		c1 = max(sweep_start, sweep_stop);
+		c2 = c1 + sweep_delta;
 	}
-	if(search_heterodimers)
+
+	// a sparse file leaves out the pairs scoring at least its cutoff, which must not matter for these cutoffs
+	if (fname.find(".bin") != string::npos && (read_file_header(fname).flags & MatrixFlags::sparse))
 	{
-		for(int i=0;i<n_peptides;i++)
+		float sparse_cutoff = read_sparse_header(fname).cutoff;
+		if (c1 >= sparse_cutoff || c2 > sparse_cutoff)
 		{
-			for(int j=i+1;j<n_peptides;j++)
-			{
-				if(score[i][j]<=c1 &&
-				   score[i][i] >= c2 &&
-				   score[j][j] >= c2 && !will_interact_with_initial(make_pair(i, j)))
-					vertices.push_back(make_pair(i, j));
-			}
+			fprintf(stderr, "%s only holds the pairs scoring below %g, the cutoffs have to be below it\n", fname.c_str(), sparse_cutoff);
+			exit(1);
 		}
 	}
 
+	score = read_scores(fname, fasta_name);
+	cerr<<n_peptides<<" peptides\n";
+
+	read_initial_set();
+
+	if (!sweep_range.empty())
+	{
+		sweep(sweep_start, sweep_stop, sweep_step, sweep_delta);
+
+		clock_t stop_time = clock();
+		printf( "Total elapsed time: %.2lfs\n", double(stop_time - start_time)/CLOCKS_PER_SEC);
+		return 0;
+	}
+
+	find_vertices();
 
 	size_t n = vertices.size(), m = 0;
 	if (n == 0)
@@ -163,45 +435,7 @@ int main(int argc, char** argv)
 		cerr << "Running max_clique on " << n << " vertices\n";
 	}
 
-	degrees.resize(n, 0);
-	conn.resize(n);
-  	for (int i=0; i < n; i++) {
-    	conn[i].resize(n, 0);
-  	}
-
-	for(int i=0;i<n;i++)
-	{
-		for(int j=0;j<i;j++)
-		{
-			if(!will_interact(vertices[i], vertices[j]))
-			{
-				conn[i][j] = conn[j][i] = true;
-				degrees[i]++;
-				degrees[j]++;
-				m++;
-			}
-		}
-	}
-
-	graph.init(conn, degrees);
-
-	ParallelMaximumCliqueProblem<
-            int,                        // vertex ID
-            BitstringSet,               // vertex set
-            Graph<BitstringSet>,        // graph
-            BBGreedyColorSort<Graph<BitstringSet>>,        // color sort
-            BBMcrSort ,       // initial sort
-            ProgressReporter  //user callback
-	> problem(graph);
-
-    int n_threads = thread::hardware_concurrency(), n_jobs = 2*n_threads;
-    std::vector<int> affinities;
-    printf("Running on %d threads, %d jobs\n", n_threads, n_jobs);
-
-    problem.search(n_threads, n_jobs, affinities);
-    problem.outputStatistics(false); std::cout << "\n";
-    std::cout << "Thread efficiency = " << std::setprecision(3) << problem.workerEfficiency() << "\n\n";
-    //print_clique(out_name, problem.getClique(), graph, "");
+	solve(BitstringSet(), m);
 
 	clock_t stop_time = clock();
 	printf( "Total elapsed time: %.2lfs\n", double(stop_time - start_time)/CLOCKS_PER_SEC);
@@ -0,0 +1,158 @@
+// Runs fastscore on a random input in each of its output modes and checks that they all hold the scores of a plain
+// in-memory run: streaming and extending with the smallest memory budget, so that every panel and copy is split,
+// scoring in shards and merging them, and keeping only the pairs below a cutoff.
+//
+// usage: fastscore_roundtrip_test FASTSCORE FASTSCORE-MERGE WORKDIR
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "common/SpecialMatrices.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+static int failures = 0;
+
+static void check(bool ok, const string& what)
+{
+	if (ok) return;
+	failures++;
+	printf("FAILED: %s\n", what.c_str());
+}
+
+static string fastscore, fastscore_merge;
+static fs::path workdir;
+
+static string path(const string& name)
+{
+	return (workdir / name).string();
+}
+
+static bool run(const string& command)
+{
+	auto quiet = command + " > " + path("log.txt");
+	if (system(quiet.c_str()) == 0) return true;
+	check(false, "running " + command);
+	return false;
+}
+
+static void write_fasta(const string& name, size_t n, mt19937& rng)
+{
+	const string residues = "ACDEFGHIKLMNPQRSTVWY";
+	ofstream out(path(name));
+	for (size_t i = 0; i < n; i++)
+	{
+		out << ">p" << i << "\n";
+		auto length = 7 * uniform_int_distribution<size_t>(3, 6)(rng);
+		for (size_t k = 0; k < length; k++) out << residues[uniform_int_distribution<size_t>(0, residues.size() - 1)(rng)];
+		out << "\n";
+	}
+}
+
+static vector<char> read_file(const string& file)
+{
+	ifstream in(file, ios::binary);
+	return { istreambuf_iterator<char>(in), istreambuf_iterator<char>() };
+}
+
+// the outputs at basename hold the same bytes as the in-memory ones at reference
+static void check_same(const string& reference, const string& basename, const string& what, const vector<string>& suffixes = { ".bin", ".orientation.bin", ".align.bin" })
+{
+	for (auto& suffix : suffixes)
+	{
+		auto expected = read_file(path(reference + suffix)), actual = read_file(path(basename + suffix));
+		check(!expected.empty() && expected == actual, what + ": " + basename + suffix + " differs from the in-memory run");
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 4)
+	{
+		printf("usage: %s FASTSCORE FASTSCORE-MERGE WORKDIR\n", argv[0]);
+		return 2;
+	}
+	fastscore = argv[1];
+	fastscore_merge = argv[2];
+	workdir = argv[3];
+	fs::create_directories(workdir);
+
+	// enough peptides for several panels of a single tile row at the smallest budget
+	const size_t n = 700, old_n = 300;
+	mt19937 rng(20240605);
+	write_fasta("all.fasta", n, rng);
+	{
+		ifstream in(path("all.fasta"));
+		ofstream out(path("old.fasta"));
+		string line;
+		for (size_t k = 0; k < 2 * old_n && getline(in, line); k++) out << line << "\n";
+	}
+
+	auto score = [&](const string& fasta, const string& basename, const string& args) {
+		return run(fastscore + " " + path(fasta) + " --basename=" + path(basename) + " --orientation=both --max-heptad-displacement=1 " + args);
+	};
+
+	if (!score("all.fasta", "reference", "")) return 1;
+
+	if (score("all.fasta", "stream", "--stream=1 --memory-budget=1")) check_same("reference", "stream", "--stream");
+
+	if (score("old.fasta", "old", "") && score("all.fasta", "extended", "--extend=" + path("old.bin") + " --extend-fasta=" + path("old.fasta") + " --memory-budget=1"))
+	{
+		check_same("reference", "extended", "--extend");
+	}
+
+	bool sharded = true;
+	for (int k = 0; k < 3; k++) sharded = sharded && score("all.fasta", "sharded", "--shard=" + to_string(k) + "/3");
+	if (sharded && run(fastscore_merge + " " + path("sharded.shard-0-of-3") + " " + path("sharded.shard-1-of-3") + " " + path("sharded.shard-2-of-3") + " --memory-budget=1"))
+	{
+		check_same("reference", "sharded", "--shard and merge");
+	}
+
+	// the other formats are checked against their own in-memory run
+	for (string format : { "packed", "records" })
+	{
+		if (score("all.fasta", "reference_" + format, "--output-format=" + format) &&
+			score("all.fasta", "stream_" + format, "--output-format=" + format + " --stream=1 --memory-budget=1"))
+		{
+			auto suffixes = format == "records" ? vector<string>{ ".records.bin" } : vector<string>{ ".bin", ".orientation.bin", ".align.bin" };
+			check_same("reference_" + format, "stream_" + format, "--stream --output-format=" + format, suffixes);
+		}
+	}
+
+	// a cutoff keeping about a tenth of the pairs
+	auto dense = SquareMatrix<score_t>::from_binary<score_t>(path("reference.bin"));
+	vector<score_t> scores(dense[0], dense[0] + n * n);
+	nth_element(scores.begin(), scores.begin() + scores.size() / 10, scores.end());
+	if (score("all.fasta", "sparse", "--sparse-below=" + to_string(scores[scores.size() / 10])))
+	{
+		auto sparse = SquareMatrix<score_t>::from_sparse(path("sparse.sparse.bin"));
+		auto cutoff = read_sparse_header(path("sparse.sparse.bin")).cutoff;
+		size_t kept = 0, wrong = 0;
+		for (size_t i = 0; i < n; i++)
+		{
+			for (size_t j = 0; j < n; j++)
+			{
+				kept += dense[i][j] < cutoff;
+				wrong += sparse[i][j] != (dense[i][j] < cutoff ? dense[i][j] : INFINITY);
+			}
+		}
+		check(kept > 0 && wrong == 0, "--sparse-below: " + to_string(wrong) + " pairs differ from the dense scores");
+	}
+
+	if (failures > 0)
+	{
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	printf("All output modes hold the in-memory scores\n");
+	return 0;
+}
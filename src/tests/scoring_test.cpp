@@ -0,0 +1,392 @@
+// Checks the scoring engines against straightforward ports of the residue by residue scoring they replaced:
+// compiled and batched Potapov scores have to match it bit for bit, quantized ones within max_error() and
+// profile ones within float rounding, and CIPA scores bit for bit, also on chains holding other characters than
+// uppercase residues.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "scoring/PotapovScores.h"
+#include "scoring/ScoringEngineBCIPA.h"
+#include "scoring/ScoringEngineICIPA.h"
+#include "scoring/ScoringEnginePotapov.h"
+#include "scoring/ScoringEngineQCIPA.h"
+
+using namespace std;
+
+static int failures = 0;
+
+static void check(bool ok, const string& what)
+{
+	if (ok) return;
+	if (++failures <= 20) printf("FAILED: %s\n", what.c_str());
+}
+
+// The Potapov scoring of the original engine: every tuple of residues, sorted by its last position, adds its
+// weight unless one of its residues is a gap or past the end of its chain.
+class ReferencePotapov
+{
+	struct ResiduePointer
+	{
+		uint16_t pos;
+		uint8_t chain_id;
+		char reg;
+	};
+
+	template<int k>
+	struct Tuple
+	{
+		array<ResiduePointer, k> res;
+		int weight_array_index = 0;
+
+		uint16_t max_pos() const
+		{
+			return max_element(res.begin(), res.end(), [](auto a, auto b) { return a.pos < b.pos; })->pos;
+		}
+	};
+
+	static const int max_peptide_length = ScoringEnginePotapov::max_peptide_length;
+
+	vector<array<float, 20 * 20>> pair_weights;
+	vector<array<float, 20 * 20 * 20>> triple_weights;
+	map<string, int> pair_register_map, triple_register_map;
+	vector<Tuple<2>> pairs;
+	vector<Tuple<3>> triples;
+
+	template<int k, typename Weights>
+	static void insert_weight(string_view registers, string_view residues, float weight, Weights& weights, map<string, int>& rmap)
+	{
+		auto idx = rmap.emplace(string(registers), int(rmap.size())).first->second;
+		if (size_t(idx) >= weights.size()) weights.resize(idx + 1);
+		weights[idx][detail::residues_hash<k>(residues)] = weight;
+	}
+
+	void init_pairs()
+	{
+		const char ha[] = "FGABCDE";
+		for (int i = 0; i < max_peptide_length; i++)
+		{
+			for (int j = max(0, i - 7 + 1); j < min(max_peptide_length, i + 7); j++)
+			{
+				Tuple<2> pair{ { ResiduePointer{ uint16_t(i), 0, ha[i % 7] }, ResiduePointer{ uint16_t(j), 1, ha[j % 7] } } };
+				if (i > j) swap(pair.res[0], pair.res[1]);
+
+				auto idx = pair_register_map.find(string{ pair.res[0].reg, pair.res[1].reg });
+				if (idx == pair_register_map.end()) continue;
+				pair.weight_array_index = idx->second;
+				pairs.push_back(pair);
+			}
+		}
+		sort(pairs.begin(), pairs.end(), [](auto& a, auto& b) { return a.max_pos() < b.max_pos(); });
+	}
+
+	void init_triples()
+	{
+		const char ha[] = "FGABCDE";
+		static const map<string, pair<bool, bool>> allowed_chain_sequences = {
+			{"GDE", {0, 1}}, {"GAE", {1, 1}}, {"DEG", {1, 0}}, {"EGA", {1, 0}},
+			{"GAD", {1, 0}}, {"ADE", {1, 0}}, {"DGA", {0, 1}}, {"DEA", {1, 1}},
+			{"AAD", {1, 1}}, {"DDA", {1, 1}},
+		};
+
+		for (int _i = 0; _i < max_peptide_length; _i++)
+		{
+			for (int _j = _i + 1; _j < 2 * max_peptide_length; _j++)
+			{
+				for (int _k = max(_j + 1, max_peptide_length); _k < 2 * max_peptide_length; _k++)
+				{
+					uint16_t i = _i % max_peptide_length, j = _j % max_peptide_length, k = _k % max_peptide_length;
+					uint8_t c_i = _i / max_peptide_length, c_j = _j / max_peptide_length, c_k = _k / max_peptide_length;
+					if (abs(i - j) >= 7 || abs(i - k) >= 7 || abs(k - j) >= 7) continue;
+					if (c_i == c_j && c_j == c_k) continue;
+
+					Tuple<3> triple{ { ResiduePointer{ i, c_i, ha[i % 7] }, ResiduePointer{ j, c_j, ha[j % 7] }, ResiduePointer{ k, c_k, ha[k % 7] } } };
+					sort(triple.res.begin(), triple.res.end(), [](auto t1, auto t2) {
+						return t1.pos == t2.pos ? t1.chain_id < t2.chain_id : t1.pos < t2.pos;
+					});
+					if (triple.res[0].pos == triple.res[1].pos && triple.res[0].chain_id == triple.res[2].chain_id)
+					{
+						swap(triple.res[0], triple.res[1]);
+					}
+
+					string registers{ triple.res[0].reg, triple.res[1].reg, triple.res[2].reg };
+					bool difference1 = triple.res[0].chain_id != triple.res[1].chain_id;
+					bool difference2 = triple.res[0].chain_id != triple.res[2].chain_id;
+					auto seq = allowed_chain_sequences.find(registers);
+					if (seq == allowed_chain_sequences.end() || seq->second != make_pair(difference1, difference2)) continue;
+
+					auto idx = triple_register_map.find(registers);
+					if (idx == triple_register_map.end()) continue;
+					triple.weight_array_index = idx->second;
+					triples.push_back(triple);
+				}
+			}
+		}
+		sort(triples.begin(), triples.end(), [](auto& a, auto& b) { return a.max_pos() < b.max_pos(); });
+	}
+
+	template<int k, typename Weights>
+	static float generic_score(string_view chain1, string_view chain2, const vector<Tuple<k>>& tuples, const Weights& weights)
+	{
+		string_view chains[] = { chain1, chain2 };
+		auto max_length = max(chain1.length(), chain2.length());
+
+		float res = 0;
+		for (auto& tuple : tuples)
+		{
+			if (tuple.max_pos() >= max_length) break;
+
+			char buf[k];
+			bool gap = false;
+			for (int i = 0; i < k; i++)
+			{
+				auto& chain = chains[tuple.res[i].chain_id];
+				auto pos = tuple.res[i].pos;
+				gap = gap || pos >= chain.size() || chain[pos] == '-';
+				if (!gap) buf[i] = chain[pos];
+			}
+			if (!gap) res += weights[tuple.weight_array_index][detail::residues_hash<k>({ buf, k })];
+		}
+		return res;
+	}
+
+public:
+	ReferencePotapov()
+	{
+		for (const PotapovScore& s : potapov_scores)
+		{
+			if (s.registers.length() == 2) insert_weight<2>(s.registers, s.residues, s.value, pair_weights, pair_register_map);
+			else insert_weight<3>(s.registers, s.residues, s.value, triple_weights, triple_register_map);
+		}
+		init_pairs();
+		init_triples();
+	}
+
+	float score(string_view chain1, string_view chain2) const
+	{
+		const float w0 = -4.54197f;
+		return w0 + generic_score(chain1, chain2, pairs, pair_weights) + generic_score(chain1, chain2, triples, triple_weights);
+	}
+};
+
+// The CIPA scoring of the original engines, which skipped every position holding anything but an uppercase letter.
+template<typename CIPAImpl>
+class ReferenceCIPA
+{
+	using weights_t = array<float, 20 * 20>;
+	weights_t c_scores, es_scores, cv_scores, nterm_c_scores;
+
+	template<typename Iterable>
+	static void insert_weights(const Iterable& weights_to_insert, weights_t& weights)
+	{
+		weights.fill(0);
+		for (auto p : weights_to_insert) weights[detail::residues_hash<2>(p.first)] = p.second;
+	}
+
+	static bool upper(char c)
+	{
+		return c >= 'A' && c <= 'Z';
+	}
+
+	static float pair_score(char c1, char c2, const weights_t& weights)
+	{
+		if (!upper(c1) || !upper(c2)) return 0;
+		char buf[2] = { c1, c2 };
+		return weights[detail::residues_hash<2>({ buf, 2 })];
+	}
+
+	static float hp_score(char c)
+	{
+		if (!upper(c)) return 0;
+		const float scores[] = { 1.41f, 0.66f, 0.99f, 1.59f, 1.16f, 0.43f, 1.05f, 1.09f, 1.23f, 1.34f, 1.30f, 0.76f, 0.34f, 1.27f, 1.21f, 0.57f, 0.76f, 0.98f, 1.02f, 0.74f };
+		return scores[detail::residue_code(c)];
+	}
+
+	static int charge_sum(string_view chain)
+	{
+		const int charges[] = { 0, 0, 0, -1, -1, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0 };
+		int charge = 0;
+		for (char c : chain)
+		{
+			if (upper(c)) charge += charges[c - 'A'];
+		}
+		return charge;
+	}
+
+public:
+	ReferenceCIPA()
+	{
+		insert_weights(CIPAImpl::c_weights, c_scores);
+		insert_weights(CIPAImpl::es_weights, es_scores);
+		insert_weights(CIPAImpl::cv_weights, cv_scores);
+		insert_weights(CIPAImpl::nterm_c_weights, nterm_c_scores);
+	}
+
+	// chains of at least three residues, as the N-terminal term reads the third one
+	float score(string_view chain1, string_view chain2) const
+	{
+		int n1 = int(chain1.length()), n2 = int(chain2.length()), n = min(n1, n2);
+
+		int n_pairs = 0;
+		float hp_sum = 0.f, es_sum = 0.f, c_sum = 0.f, cv_sum = 0.f;
+		int num_LL_on_d = 0;
+		for (int i = 0; i < n; i++)
+		{
+			int reg = i % 7;
+			if (!upper(chain1[i]) || !upper(chain2[i])) continue;
+
+			if (hp_score(chain1[i]) != 0 && hp_score(chain2[i]) != 0)
+			{
+				hp_sum += hp_score(chain1[i]) + hp_score(chain2[i]);
+				n_pairs++;
+			}
+
+			if (CIPAImpl::core_position_filter(reg))
+			{
+				c_sum += pair_score(chain1[i], chain2[i], c_scores);
+			}
+			else if (reg == 1)
+			{
+				if (i + 5 < n2)
+				{
+					if (!upper(chain2[i + 5])) continue;
+					es_sum += pair_score(chain1[i], chain2[i + 5], es_scores);
+				}
+				if (i + 5 < n1)
+				{
+					if (!upper(chain1[i + 5])) continue;
+					es_sum += pair_score(chain2[i], chain1[i + 5], es_scores);
+				}
+			}
+
+			if (reg == 5 && chain1[i] == 'L' && chain2[i] == 'L') num_LL_on_d++;
+
+			if (reg == 2 && i + 7 < n)
+			{
+				cv_sum += pair_score(chain1[i], chain1[i + 7], cv_scores);
+				cv_sum += pair_score(chain2[i], chain2[i + 7], cv_scores);
+			}
+		}
+
+		CIPAScores scores;
+		scores.avg_hp_sum = hp_sum / n_pairs;
+		scores.c_sum = c_sum;
+		scores.es_sum = es_sum;
+		scores.cv_sum = cv_sum;
+		scores.nterm_c = pair_score(chain1[2], chain2[2], nterm_c_scores);
+		scores.num_LL_on_d = num_LL_on_d;
+		scores.charge_prod = charge_sum(chain1) * charge_sum(chain2);
+		return -CIPAImpl::calculate_score(scores);
+	}
+};
+
+static string random_chain(mt19937& rng, size_t min_length, size_t max_length, string_view alphabet)
+{
+	string chain(uniform_int_distribution<size_t>(min_length, max_length)(rng), ' ');
+	for (auto& c : chain) c = alphabet[uniform_int_distribution<size_t>(0, alphabet.size() - 1)(rng)];
+	return chain;
+}
+
+static bool same(float a, float b)
+{
+	return a == b || (isnan(a) && isnan(b));
+}
+
+static const string_view residues = "ACDEFGHIKLMNPQRSTVWY";
+// residues, gaps, and letters and symbols that are not residues
+static const string_view mixed = "ACDEFGHIKLMNPQRSTVWYacdeklqrvBJOUXZ--.*x";
+
+static void test_potapov(mt19937& rng)
+{
+	using ScoringOptions::Precision;
+	const size_t max_length = ScoringEnginePotapov::max_peptide_length, batch_size = ScoringEnginePotapov::batch_size;
+
+	ReferencePotapov reference;
+	ScoringEnginePotapov float_engine;
+	ScoringEnginePotapov int16_engine(Precision::int16), int8_engine(Precision::int8);
+	ScoringEnginePotapov* engines[] = { &float_engine, &int16_engine, &int8_engine };
+	const char* names[] = { "float32", "int16", "int8" };
+
+	for (int round = 0; round < 200; round++)
+	{
+		string chains1[batch_size], chains2[batch_size];
+		float expected[batch_size];
+		size_t lengths[batch_size];
+		vector<uint8_t> codes(2 * max_length * batch_size), lane_codes(2 * max_length);
+		for (size_t l = 0; l < batch_size; l++)
+		{
+			chains1[l] = random_chain(rng, 1, max_length, "ACDEFGHIKLMNPQRSTVWY-");
+			chains2[l] = random_chain(rng, 1, max_length, "ACDEFGHIKLMNPQRSTVWY-");
+			expected[l] = reference.score(chains1[l], chains2[l]);
+			lengths[l] = max(chains1[l].length(), chains2[l].length());
+			ScoringEnginePotapov::encode(chains1[l], codes.data() + l, batch_size);
+			ScoringEnginePotapov::encode(chains2[l], codes.data() + max_length * batch_size + l, batch_size);
+		}
+
+		for (int e = 0; e < 3; e++)
+		{
+			auto& engine = *engines[e];
+			float batch[batch_size];
+			engine.score_batch(codes.data(), lengths, batch);
+
+			for (size_t l = 0; l < batch_size; l++)
+			{
+				auto pair = chains1[l] + " / " + chains2[l] + " at " + names[e];
+				auto single = engine.score(chains1[l], chains2[l]);
+				if (e == 0) check(single == expected[l], "compiled score of " + pair);
+				else check(abs(single - expected[l]) <= engine.max_error(lengths[l]) + 1e-4f, "quantized score of " + pair);
+				check(single == batch[l], "batch score of " + pair);
+			}
+		}
+
+		for (size_t l = 0; l < batch_size; l++)
+		{
+			ScoringEnginePotapov::encode(chains1[l], lane_codes.data());
+			ScoringEnginePotapov::encode(chains2[l], lane_codes.data() + max_length);
+			ScoringEnginePotapov::Profile profile;
+			float_engine.profile(lane_codes.data(), lengths[l], profile);
+			check(abs(float_engine.score(profile, lane_codes.data() + max_length) - expected[l]) <= 1e-4f, "profile score of " + chains1[l] + " / " + chains2[l]);
+		}
+	}
+}
+
+template<typename CIPAImpl>
+static void test_cipa(mt19937& rng, const char* name)
+{
+	ReferenceCIPA<CIPAImpl> reference;
+	CIPAHelper<CIPAImpl> engine;
+
+	for (int round = 0; round < 2000; round++)
+	{
+		// chains of equal length, as fastscore scores them
+		auto alphabet = round % 2 ? mixed : residues;
+		auto chain1 = random_chain(rng, 7, 70, alphabet);
+		auto chain2 = random_chain(rng, chain1.length(), chain1.length(), alphabet);
+		check(same(engine.score(chain1, chain2), reference.score(chain1, chain2)), string(name) + " score of " + chain1 + " / " + chain2);
+	}
+}
+
+int main()
+{
+	mt19937 rng(20240605);
+
+	test_potapov(rng);
+	test_cipa<BCIPAImpl>(rng, "bCIPA");
+	test_cipa<QCIPAImpl>(rng, "qCIPA");
+	test_cipa<ICIPA_core_vert_impl>(rng, "iCIPA core-vert");
+	test_cipa<ICIPA_nter_core_impl>(rng, "iCIPA N-ter-core");
+
+	if (failures > 0)
+	{
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	printf("All scoring checks passed\n");
+	return 0;
+}
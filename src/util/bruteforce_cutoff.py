@@ -66,8 +66,10 @@ def bruteforce(path, fasta_path=None, fast_exit=True, delta=1, step=0.5, timeout
         output_path = (
             temp_dir / "cutoff_bruteforce_{}.txt".format(idx)).relative_to(Path.cwd())
         try:
+            # the solver stops its search by itself, the timeout only guards the rest of the run
             run([r'..\..\build-win\solver', str(path), '--binding-cutoff={}'.format(
-                binding_cutoff), '--nonbinding-cutoff={}'.format(nonbinding_cutoff), '--out-name={}'.format(output_path), '--fasta-name={}'.format(fasta_path)], stdout=DEVNULL, stderr=DEVNULL, timeout=timeout)
+                binding_cutoff), '--nonbinding-cutoff={}'.format(nonbinding_cutoff), '--out-name={}'.format(output_path), '--fasta-name={}'.format(fasta_path),
+                '--time-limit={}'.format(timeout)], stdout=DEVNULL, stderr=DEVNULL, timeout=2 * timeout + 60)
         except TimeoutExpired:
             print('Timeout expired for cutoffs', binding_cutoff,
                   nonbinding_cutoff, file=sys.stderr)
@@ -1,8 +1,73 @@
 import numpy as np
 
-def load(path):
-    header = np.fromfile(path, dtype=np.uint64, count=4)
-    n, m = header[1], header[2]
-    offset = int(header[3])
-    del header
-    return np.memmap(path, dtype='float32', mode='r', offset=offset, shape=(n, m))
+# FileHeader::flags, see common/MemoryMappedMatrix.h
+PACKED = 1
+ANTISYMMETRIC = 2
+RECORDS = 4
+SPARSE = 8
+
+header_dtype = np.dtype([('version', np.uint16), ('flags', np.uint16), ('element_size', np.uint32),
+                         ('n', np.uint64), ('m', np.uint64), ('offset', np.uint64)])
+
+
+def load(path, dtype='float32'):
+    header = np.fromfile(path, dtype=header_dtype, count=1)[0]
+    n, m = int(header['n']), int(header['m'])
+    offset = int(header['offset'])
+    if header['flags'] & SPARSE:
+        # the pairs left out score at least the cutoff
+        cutoff, row_start, entries = load_sparse(path)
+        full = np.full((n, m), np.inf, dtype=np.float32)
+        rows = np.repeat(np.arange(n), np.diff(row_start))
+        full[rows, entries['col']] = entries['score']
+        if header['flags'] & PACKED:
+            full[entries['col'], rows] = entries['score']
+        return full
+    if header['flags'] & RECORDS:
+        tri = load_records(path)['score']
+        rows, cols = np.tril_indices(n)
+        full = np.empty((n, n), dtype=np.float32)
+        full[rows, cols] = full[cols, rows] = tri
+        return full
+    if not header['flags'] & PACKED:
+        return np.memmap(path, dtype=dtype, mode='r', offset=offset, shape=(n, m))
+
+    # packed files hold the lower triangle row by row, which is the order of np.tril_indices
+    tri = np.memmap(path, dtype=dtype, mode='r', offset=offset, shape=(n * (n + 1) // 2,))
+    rows, cols = np.tril_indices(n)
+    full = np.empty((n, n), dtype=dtype)
+    full[cols, rows] = -tri if header['flags'] & ANTISYMMETRIC else tri
+    full[rows, cols] = tri
+    return full
+
+
+sparse_header_dtype = np.dtype([('cutoff', np.float32), ('reserved', np.uint32), ('entries', np.uint64)])
+sparse_entry_dtype = np.dtype([('col', np.uint32), ('score', np.float32), ('alignment', np.int32),
+                               ('orientation', np.uint8), ('reserved', np.uint8, 3)])
+
+
+def load_sparse(path):
+    """Zero-copy view of a fastscore sparse file as (cutoff, row_start, entries): the entries of row i are
+    entries[row_start[i]:row_start[i + 1]], sorted by column. With the packed flag, rows hold the lower triangle."""
+    header = np.fromfile(path, dtype=header_dtype, count=1)[0]
+    assert header['flags'] & SPARSE, f'{path} is not a sparse file'
+    n, offset = int(header['n']), int(header['offset'])
+    sparse_header = np.fromfile(path, dtype=sparse_header_dtype, count=1, offset=header_dtype.itemsize)[0]
+    row_start = np.memmap(path, dtype=np.uint64, mode='r', offset=offset, shape=(n + 1,))
+    count = int(sparse_header['entries'])
+    if count == 0:
+        return float(sparse_header['cutoff']), row_start, np.empty(0, dtype=sparse_entry_dtype)
+    entries = np.memmap(path, dtype=sparse_entry_dtype, mode='r', offset=offset + 8 * (n + 1), shape=(count,))
+    return float(sparse_header['cutoff']), row_start, entries
+
+
+record_dtype = np.dtype([('score', np.float32), ('code', np.uint8)])
+
+
+def load_records(path):
+    """Zero-copy view of a fastscore records file: the lower triangle, row by row, as (score, code) pairs.
+    The orientation is code & 3 and the alignment is code.view(np.int8) >> 2."""
+    header = np.fromfile(path, dtype=header_dtype, count=1)[0]
+    assert header['flags'] & RECORDS, f'{path} is not a records file'
+    n = int(header['n'])
+    return np.memmap(path, dtype=record_dtype, mode='r', offset=int(header['offset']), shape=(n * (n + 1) // 2,))